@@ -0,0 +1,831 @@
+/*
+archive.c
+contains implementation code for archives of independently compressed files
+*/
+
+#define _GNU_SOURCE
+#include "globals.h"
+#include "bitio.h"
+#include "encode.h"
+#include "decode.h"
+#include "budget.h"
+#include "archive.h"
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define ARCHIVE_BUFSIZE (1 << 16)   //bytes read from a member at a time
+#define ARCHIVE_SPILL (16 << 20)    //compressed bytes held before streaming
+#define ARCHIVE_ENTRY (40)          //bytes in a directory entry before the name
+#define ARCHIVE_TRAILER (20)        //bytes in the trailer
+
+// -----------------------------------------------------------------------------
+// struct member
+// -----------------------------------------------------------------------------
+// Description:
+//   a file in an archive
+// Fields:
+//   char* path - where the file is read from when creating the archive
+//   char* name - the name stored in the archive
+//   uint32_t mode - the permission bits of the file
+//   int64_t mtime - the modification time of the file, in seconds
+//   uint64_t size - the original length of the file
+//   uint64_t offset - the offset of the compressed stream in the archive
+//   uint64_t csize - the length of the compressed stream
+//   int selected - 1 if the member is to be extracted
+
+struct member{
+  char* path;
+  char* name;
+  uint32_t mode;
+  int64_t mtime;
+  uint64_t size;
+  uint64_t offset;
+  uint64_t csize;
+  int selected;
+};
+
+// -----------------------------------------------------------------------------
+// struct archive
+// -----------------------------------------------------------------------------
+// Description:
+//   the state shared by the threads working on an archive
+// Fields:
+//   struct member* members - the members
+//   size_t count - the number of members
+//   size_t cap - the number of members allocated
+//   size_t next - the index of the next member for a thread to take
+//   Options* opt - the options the archive was run with
+//   int fd - the archive being read, when extracting
+//   uint64_t written - the number of bytes written to the archive so far
+//   EncoderStats total - the statistics of all the members compressed
+//   pthread_mutex_t lock - protects next and total
+//   pthread_mutex_t outlock - held while a thread writes to the archive
+
+struct archive{
+  struct member* members;
+  size_t count;
+  size_t cap;
+  size_t next;
+  Options* opt;
+  int fd;
+  uint64_t written;
+  EncoderStats total;
+  pthread_mutex_t lock;
+  pthread_mutex_t outlock;
+};
+
+// -----------------------------------------------------------------------------
+// struct archiveworker
+// -----------------------------------------------------------------------------
+// Description:
+//   a thread working on an archive, with everything it reuses between members
+// Fields:
+//   struct archive* ar - the archive
+//   struct member* m - the member being worked on
+//   Encoder enc, Decoder dec - created for the first member, and reset for
+//                              each later one
+//   BitWriter out - where the compressed or extracted member is written
+//   BitReader in - reads a member from the archive, using offset and left
+//   unsigned char* pending - the compressed member, until it is written out
+//   size_t len - the number of bytes in pending
+//   size_t cap - the number of bytes allocated for pending
+//   int streaming - 1 if the member is too big to hold, so outlock is held
+//                   and its bytes go straight to the archive
+//   int fd - the file being extracted
+//   uint64_t offset - where the next bytes of the member are read from
+//   uint64_t left - how many bytes of the member are still to be read
+//   unsigned char buf[] - the buffer for reading files to compress
+
+struct archiveworker{
+  struct archive* ar;
+  struct member* m;
+  Encoder enc;
+  Decoder dec;
+  BitWriter out;
+  BitReader in;
+  unsigned char* pending;
+  size_t len;
+  size_t cap;
+  int streaming;
+  int fd;
+  uint64_t offset;
+  uint64_t left;
+  unsigned char buf[ARCHIVE_BUFSIZE];
+};
+
+static size_t memberSource(void* ctx, unsigned char* buf, size_t n);
+
+// -----------------------------------------------------------------------------
+// int archiveThreads
+// -----------------------------------------------------------------------------
+// Description:
+//   picks the number of threads for an archive: the number asked for, or one
+//   per processor, limited by the members and the memory budget
+// Parameters:
+//   Options* opt - the options holding threads and maxmemory
+//   Options* stream - the parameters of the members' streams
+//   size_t count - the number of members
+
+static int archiveThreads(Options* opt, Options* stream, size_t count){
+  int n = threadsInBudget(opt, stream);
+
+  if((size_t)n > count) n = count;
+  if(n < 1) n = 1;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void runThreads
+// -----------------------------------------------------------------------------
+// Description:
+//   runs a function on a number of threads, each with its own worker, and
+//   waits for them all
+// Parameters:
+//   struct archive* ar - the archive the workers work on
+//   int n - the number of threads
+//   void* (*run)(void*) - the function, called with a struct archiveworker*
+//   ByteSink sink - the sink of the workers' BitWriters
+
+static void runThreads(struct archive* ar, int n, void* (*run)(void*),
+                       ByteSink sink){
+  struct archiveworker* workers = malloc(n * sizeof(*workers));
+  pthread_t* threads = malloc(n * sizeof(*threads));
+  int i;
+
+  for(i = 0; i < n; i++){
+    workers[i].ar = ar;
+    workers[i].enc = 0;
+    workers[i].dec = 0;
+    workers[i].pending = 0;
+    workers[i].len = 0;
+    workers[i].cap = 0;
+    workers[i].streaming = 0;
+    workers[i].out = bitWriterCreate(sink, &workers[i]);
+    workers[i].in = bitReaderCreate(memberSource, &workers[i]);
+    if(pthread_create(&threads[i], 0, run, &workers[i]) != 0){
+      fprintf(stderr, "Error: could not start archive threads.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for(i = 0; i < n; i++){
+    pthread_join(threads[i], 0);
+    if(workers[i].enc) encoderDestroy(workers[i].enc);
+    if(workers[i].dec) decoderDestroy(workers[i].dec);
+    bitWriterDestroy(workers[i].out);
+    bitReaderDestroy(workers[i].in);
+    free(workers[i].pending);
+  }
+
+  free(threads);
+  free(workers);
+}
+
+// -----------------------------------------------------------------------------
+// struct member* nextMember
+// -----------------------------------------------------------------------------
+// Description:
+//   takes the next selected member for a thread to work on
+// Parameters:
+//   struct archive* ar - the archive
+// Return value:
+//   the member, or a null pointer when there are none left
+
+static struct member* nextMember(struct archive* ar){
+  struct member* m = 0;
+
+  pthread_mutex_lock(&ar->lock);
+  while(ar->next < ar->count && !ar->members[ar->next].selected){
+    ar->next++;
+  }
+  if(ar->next < ar->count){
+    m = &ar->members[ar->next++];
+  }
+  pthread_mutex_unlock(&ar->lock);
+
+  return m;
+}
+
+// -----------------------------------------------------------------------------
+// void addMember
+// -----------------------------------------------------------------------------
+// Description:
+//   adds a file to an archive, or all the regular files below a directory.
+//   Other kinds of files are skipped with a warning.
+// Parameters:
+//   struct archive* ar - the archive
+//   const char* path - the path of the file or directory
+
+static void addMember(struct archive* ar, const char* path){
+  struct dirent** entries;
+  struct member* m;
+  struct stat st;
+  const char* name = path;
+  char* child;
+  int i, n;
+
+  if(lstat(path, &st) != 0){
+    fprintf(stderr, "Error: could not read %s.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  if(S_ISDIR(st.st_mode)){
+    if((n = scandir(path, &entries, 0, alphasort)) < 0){
+      fprintf(stderr, "Error: could not read directory %s.\n", path);
+      exit(EXIT_FAILURE);
+    }
+    for(i = 0; i < n; i++){
+      if(strcmp(entries[i]->d_name, ".") && strcmp(entries[i]->d_name, "..")){
+        child = malloc(strlen(path) + strlen(entries[i]->d_name) + 2);
+        sprintf(child, "%s%s%s", path,
+                path[strlen(path) - 1] == '/' ? "" : "/", entries[i]->d_name);
+        addMember(ar, child);
+        free(child);
+      }
+      free(entries[i]);
+    }
+    free(entries);
+    return;
+  }
+
+  if(!S_ISREG(st.st_mode)){
+    fprintf(stderr, "Warning: skipping %s, which is not a regular file.\n",
+            path);
+    return;
+  }
+
+  //store a relative name, so extraction stays below the current directory
+  for(;;){
+    if(name[0] == '/') name++;
+    else if(!strncmp(name, "./", 2)) name += 2;
+    else if(!strncmp(name, "../", 3)) name += 3;
+    else break;
+  }
+
+  if(ar->count == ar->cap){
+    ar->cap = ar->cap ? 2 * ar->cap : 1024;
+    ar->members = realloc(ar->members, ar->cap * sizeof(*ar->members));
+  }
+  m = &ar->members[ar->count++];
+  m->path = strdup(path);
+  m->name = strdup(name);
+  m->mode = st.st_mode & 07777;
+  m->mtime = st.st_mtime;
+  m->size = 0;
+  m->offset = 0;
+  m->csize = 0;
+  m->selected = 1;
+}
+
+// -----------------------------------------------------------------------------
+// void archiveWrite
+// -----------------------------------------------------------------------------
+// Description:
+//   writes bytes to the archive on stdout. outlock must be held.
+// Parameters:
+//   struct archive* ar - the archive
+//   const unsigned char* buf - the bytes to write
+//   size_t n - the number of bytes in buf
+
+static void archiveWrite(struct archive* ar, const unsigned char* buf,
+                         size_t n){
+  if(fwrite(buf, 1, n, stdout) != n){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+  ar->written += n;
+}
+
+// -----------------------------------------------------------------------------
+// size_t memberSink
+// -----------------------------------------------------------------------------
+// Description:
+//   the ByteSink for compressed members, ctx is the struct archiveworker*.
+//   A member is held in memory until it is finished, so that the threads
+//   don't have to take turns writing. One that grows too big is written
+//   straight to the archive instead, keeping the archive to itself until
+//   it ends.
+
+static size_t memberSink(void* ctx, const unsigned char* buf, size_t n){
+  struct archiveworker* w = ctx;
+  struct archive* ar = w->ar;
+
+  if(!w->streaming && w->len + n > ARCHIVE_SPILL){
+    pthread_mutex_lock(&ar->outlock);
+    w->m->offset = ar->written;
+    archiveWrite(ar, w->pending, w->len);
+    w->len = 0;
+    w->streaming = 1;
+  }
+
+  if(w->streaming){
+    archiveWrite(ar, buf, n);
+  }
+  else{
+    if(w->len + n > w->cap){
+      w->cap = w->len + n > 2 * w->cap ? w->len + n : 2 * w->cap;
+      w->pending = realloc(w->pending, w->cap);
+    }
+    memcpy(w->pending + w->len, buf, n);
+    w->len += n;
+  }
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void* compressThread
+// -----------------------------------------------------------------------------
+// Description:
+//   compresses members until there are none left
+// Parameters:
+//   void* arg - the struct archiveworker*
+
+static void* compressThread(void* arg){
+  struct archiveworker* w = arg;
+  struct archive* ar = w->ar;
+  EncoderStats stats;
+  uint64_t start;
+  ssize_t n;
+  int fd;
+
+  while((w->m = nextMember(ar)) != 0){
+    if((fd = open(w->m->path, O_RDONLY)) < 0){
+      fprintf(stderr, "Error: could not read %s.\n", w->m->path);
+      exit(EXIT_FAILURE);
+    }
+
+    start = bytesWritten(w->out);
+    if(w->enc){
+      encoderReset(w->enc, ar->opt);
+    }
+    else{
+      w->enc = encoderCreate(ar->opt, w->out);
+    }
+
+    while((n = read(fd, w->buf, ARCHIVE_BUFSIZE)) != 0){
+      if(n < 0){
+        if(errno == EINTR) continue;
+        fprintf(stderr, "Error: could not read %s.\n", w->m->path);
+        exit(EXIT_FAILURE);
+      }
+      encoderWrite(w->enc, w->buf, n);
+      w->m->size += n;
+    }
+    close(fd);
+    encoderFinish(w->enc);
+    w->m->csize = bytesWritten(w->out) - start;
+
+    if(!w->streaming){
+      pthread_mutex_lock(&ar->outlock);
+      w->m->offset = ar->written;
+      archiveWrite(ar, w->pending, w->len);
+      w->len = 0;
+    }
+    w->streaming = 0;
+    pthread_mutex_unlock(&ar->outlock);
+
+    encoderStats(w->enc, &stats);
+    pthread_mutex_lock(&ar->lock);
+    ar->total.bytesin += stats.bytesin;
+    ar->total.bytesout += stats.bytesout;
+    ar->total.codes += stats.codes;
+    ar->total.escapes += stats.escapes;
+    ar->total.prunes += stats.prunes;
+    ar->total.lookups += stats.lookups;
+    ar->total.hits += stats.hits;
+    pthread_mutex_unlock(&ar->lock);
+  }
+
+  return 0;
+}
+
+void archiveCreate(Options* opt){
+  struct archive ar = {.members = 0, .count = 0, .cap = 0, .next = 0,
+                       .opt = opt, .fd = -1, .written = 0};
+  uint64_t dirstart;
+  char* line = 0;
+  size_t linecap = 0, i;
+  ssize_t len;
+  FILE* list;
+  int j;
+
+  for(j = 0; j < opt->npaths; j++){
+    addMember(&ar, opt->paths[j]);
+  }
+
+  //the file list has one path per line
+  if(opt->filelist){
+    list = strcmp(opt->filelist, "-") ? fopen(opt->filelist, "r") : stdin;
+    if(list == 0){
+      fprintf(stderr, "Error: could not read %s.\n", opt->filelist);
+      exit(EXIT_FAILURE);
+    }
+    while((len = getline(&line, &linecap, list)) > 0){
+      if(line[len - 1] == '\n') line[--len] = '\0';
+      if(len > 0) addMember(&ar, line);
+    }
+    if(list != stdin) fclose(list);
+    free(line);
+  }
+
+  memset(&ar.total, 0, sizeof(ar.total));
+  pthread_mutex_init(&ar.lock, 0);
+  pthread_mutex_init(&ar.outlock, 0);
+
+  archiveWrite(&ar, (const unsigned char*)ARCHIVE_MAGIC, 4);
+  putchar(ARCHIVE_VERSION);
+  ar.written++;
+
+  if(ar.count > 0){
+    runThreads(&ar, archiveThreads(opt, opt, ar.count), compressThread,
+               memberSink);
+  }
+
+  //the central directory, in the order the members were given
+  dirstart = ar.written;
+  for(i = 0; i < ar.count; i++){
+    writeNumber(stdout, ar.members[i].offset, 8);
+    writeNumber(stdout, ar.members[i].csize, 8);
+    writeNumber(stdout, ar.members[i].size, 8);
+    writeNumber(stdout, ar.members[i].mode, 4);
+    writeNumber(stdout, ar.members[i].mtime, 8);
+    writeNumber(stdout, strlen(ar.members[i].name), 4);
+    fputs(ar.members[i].name, stdout);
+  }
+  writeNumber(stdout, dirstart, 8);
+  writeNumber(stdout, ar.count, 8);
+  fputs(ARCHIVE_MAGIC, stdout);
+
+  if(fflush(stdout) != 0){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(opt->stats){
+    ar.total.bytesout = ar.written - 5;
+    fprintf(stderr, "%zu files: ", ar.count);
+    printEncoderStats(stderr, &ar.total);
+  }
+
+  for(i = 0; i < ar.count; i++){
+    free(ar.members[i].path);
+    free(ar.members[i].name);
+  }
+  free(ar.members);
+}
+
+// -----------------------------------------------------------------------------
+// uint64_t takeNumber
+// -----------------------------------------------------------------------------
+// Description:
+//   reads a little endian number from a buffer, the same format as
+//   writeNumber
+// Parameters:
+//   const unsigned char** p - a pointer to the position in the buffer, which
+//                             is moved past the number
+//   int bytes - the number of bytes in the number
+
+static uint64_t takeNumber(const unsigned char** p, int bytes){
+  uint64_t n = 0;
+  int i;
+
+  for(i = 0; i < bytes; i++){
+    n |= (uint64_t)(*p)[i] << (CHAR_BIT * i);
+  }
+  *p += bytes;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// int readAt
+// -----------------------------------------------------------------------------
+// Description:
+//   reads a whole buffer from a file at an offset
+// Parameters:
+//   int fd - the file
+//   unsigned char* buf - the buffer to fill
+//   size_t n - the number of bytes to read
+//   uint64_t offset - where to read from
+// Return value:
+//   0 if the bytes were all read, -1 otherwise
+
+static int readAt(int fd, unsigned char* buf, size_t n, uint64_t offset){
+  ssize_t got;
+
+  while(n > 0){
+    got = pread(fd, buf, n, offset);
+    if(got < 0 && errno == EINTR) continue;
+    if(got <= 0) return -1;
+    buf += got;
+    n -= got;
+    offset += got;
+  }
+
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// size_t memberSource
+// -----------------------------------------------------------------------------
+// Description:
+//   the ByteSource for a member being decoded, ctx is the struct
+//   archiveworker*. It supplies the member's bytes and then reports the end.
+
+static size_t memberSource(void* ctx, unsigned char* buf, size_t n){
+  struct archiveworker* w = ctx;
+
+  if(n > w->left) n = w->left;
+  if(n > 0 && readAt(w->ar->fd, buf, n, w->offset) != 0){
+    fprintf(stderr, "Error: could not read input\n");
+    exit(EXIT_FAILURE);
+  }
+  w->offset += n;
+  w->left -= n;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// size_t extractSink
+// -----------------------------------------------------------------------------
+// Description:
+//   the ByteSink for extracted members, ctx is the struct archiveworker*
+
+static size_t extractSink(void* ctx, const unsigned char* buf, size_t n){
+  struct archiveworker* w = ctx;
+  return fdSink(&w->fd, buf, n);
+}
+
+// -----------------------------------------------------------------------------
+// void makeParents
+// -----------------------------------------------------------------------------
+// Description:
+//   creates the directories a member's name is in, if they don't exist
+// Parameters:
+//   const char* name - the member's name
+
+static void makeParents(const char* name){
+  char* dir = strdup(name);
+  char* p;
+
+  for(p = strchr(dir, '/'); p; p = strchr(p + 1, '/')){
+    *p = '\0';
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST){
+      fprintf(stderr, "Error: could not create directory %s.\n", dir);
+      exit(EXIT_FAILURE);
+    }
+    *p = '/';
+  }
+
+  free(dir);
+}
+
+// -----------------------------------------------------------------------------
+// void* extractThread
+// -----------------------------------------------------------------------------
+// Description:
+//   decodes members until there are none left, writing them to files unless
+//   the archive is only being checked
+// Parameters:
+//   void* arg - the struct archiveworker*
+
+static void* extractThread(void* arg){
+  struct archiveworker* w = arg;
+  struct archive* ar = w->ar;
+  int scan = ar->opt->scan;
+  Options streamopt = {.maxbits = 0};
+  struct timespec times[2];
+  uint64_t produced, position;
+  int status;
+
+  while((w->m = nextMember(ar)) != 0){
+    w->offset = w->m->offset;
+    w->left = w->m->csize;
+    bitReaderReset(w->in);
+
+    if(decoderReadHeader(w->in, &streamopt) != 0){
+      fprintf(stderr, "Error: member %s corrupted at byte 0\n", w->m->name);
+      exit(EXIT_FAILURE);
+    }
+    if(ar->opt->maxmemory
+       && memoryFootprint(&streamopt) > ar->opt->maxmemory){
+      fprintf(stderr, "Error: member %s needs %" PRIu64 " bytes of memory, "
+              "more than --max-memory allows.\n", w->m->name,
+              memoryFootprint(&streamopt));
+      exit(EXIT_FAILURE);
+    }
+
+    if(w->dec){
+      decoderReset(w->dec, &streamopt);
+    }
+    else{
+      w->dec = decoderCreate(&streamopt, w->in, scan ? 0 : w->out);
+    }
+
+    if(!scan){
+      makeParents(w->m->name);
+      if((w->fd = open(w->m->name, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0){
+        fprintf(stderr, "Error: could not create %s.\n", w->m->name);
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    while((status = decoderRun(w->dec)) == DECODE_SYNC);
+    decoderProgress(w->dec, &produced, &position);
+    if(status == DECODE_CORRUPT || produced != w->m->size){
+      fprintf(stderr, "Error: member %s corrupted at byte %" PRIu64
+              " (bit %" PRIu64 "), after %" PRIu64 " bytes of output\n",
+              w->m->name, position / CHAR_BIT, position, produced);
+      exit(EXIT_FAILURE);
+    }
+
+    if(!scan){
+      sendRemainingBits(w->out);
+      times[0].tv_sec = times[1].tv_sec = w->m->mtime;
+      times[0].tv_nsec = times[1].tv_nsec = 0;
+      if(fchmod(w->fd, w->m->mode) != 0 || futimens(w->fd, times) != 0
+         || close(w->fd) != 0){
+        fprintf(stderr, "Error: could not write %s.\n", w->m->name);
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// int safeName
+// -----------------------------------------------------------------------------
+// Description:
+//   checks that a member's name stays below the current directory
+// Parameters:
+//   const char* name - the name
+// Return value:
+//   1 if the name is safe to extract, 0 otherwise
+
+static int safeName(const char* name){
+  const char* p = name;
+
+  if(name[0] == '\0' || name[0] == '/') return 0;
+
+  while(p){
+    if(!strncmp(p, "..", 2) && (p[2] == '/' || p[2] == '\0')) return 0;
+    if((p = strchr(p, '/')) != 0) p++;
+  }
+
+  return 1;
+}
+
+// -----------------------------------------------------------------------------
+// int nameSelected
+// -----------------------------------------------------------------------------
+// Description:
+//   checks whether a member was asked for, by its name or a directory above it
+// Parameters:
+//   const char* name - the member's name
+//   const char* want - a name given on the command line
+
+static int nameSelected(const char* name, const char* want){
+  size_t len = strlen(want);
+
+  while(len > 1 && want[len - 1] == '/') len--;
+
+  return !strncmp(name, want, len) && (name[len] == '\0' || name[len] == '/');
+}
+
+void archiveExtract(Options* opt, int fd){
+  struct archive ar = {.members = 0, .count = 0, .cap = 0, .next = 0,
+                       .opt = opt, .fd = fd, .written = 0};
+  unsigned char trailer[ARCHIVE_TRAILER];
+  unsigned char* dir;
+  const unsigned char *p, *end;
+  uint64_t dirstart, count, dirlen, namelen;
+  off_t size;
+  size_t i;
+  int j, found;
+  Options streamopt = {.maxbits = 0};
+
+  if((size = lseek(fd, 0, SEEK_END)) < 0){
+    fprintf(stderr, "Error: archives must be read from a file, not a pipe.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  //the trailer gives the position of the directory
+  if(size < 5 + ARCHIVE_TRAILER
+     || readAt(fd, trailer, ARCHIVE_TRAILER, size - ARCHIVE_TRAILER) != 0
+     || memcmp(trailer + 16, ARCHIVE_MAGIC, 4) != 0){
+    fprintf(stderr, "Error: archive has no central directory.\n");
+    exit(EXIT_FAILURE);
+  }
+  p = trailer;
+  dirstart = takeNumber(&p, 8);
+  count = takeNumber(&p, 8);
+  if(dirstart < 5 || dirstart > (uint64_t)size - ARCHIVE_TRAILER
+     || count > (size - ARCHIVE_TRAILER - dirstart) / ARCHIVE_ENTRY){
+    fprintf(stderr, "Error: archive central directory corrupted.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  dirlen = size - ARCHIVE_TRAILER - dirstart;
+  dir = malloc(dirlen + 1);
+  if(readAt(fd, dir, dirlen, dirstart) != 0){
+    fprintf(stderr, "Error: could not read input\n");
+    exit(EXIT_FAILURE);
+  }
+
+  ar.count = ar.cap = count;
+  ar.members = malloc(count * sizeof(*ar.members) + 1);
+  for(p = dir, end = dir + dirlen, i = 0; i < count; i++){
+    struct member* m = &ar.members[i];
+    if(end - p < ARCHIVE_ENTRY){
+      fprintf(stderr, "Error: archive central directory corrupted.\n");
+      exit(EXIT_FAILURE);
+    }
+    m->offset = takeNumber(&p, 8);
+    m->csize = takeNumber(&p, 8);
+    m->size = takeNumber(&p, 8);
+    m->mode = takeNumber(&p, 4) & 07777;
+    m->mtime = (int64_t)takeNumber(&p, 8);
+    namelen = takeNumber(&p, 4);
+    if(namelen > (uint64_t)(end - p) || m->offset > dirstart
+       || m->csize > dirstart - m->offset){
+      fprintf(stderr, "Error: archive central directory corrupted.\n");
+      exit(EXIT_FAILURE);
+    }
+    m->name = strndup((const char*)p, namelen);
+    m->path = 0;
+    p += namelen;
+
+    m->selected = opt->npaths == 0;
+    for(j = 0; j < opt->npaths; j++){
+      if(nameSelected(m->name, opt->paths[j])) m->selected = 1;
+    }
+    if(m->selected && !opt->list && !opt->scan && !safeName(m->name)){
+      fprintf(stderr, "Error: refusing to extract %s outside the current "
+              "directory.\n", m->name);
+      exit(EXIT_FAILURE);
+    }
+  }
+  free(dir);
+
+  for(j = 0; j < opt->npaths; j++){
+    for(found = 0, i = 0; i < ar.count && !found; i++){
+      found = nameSelected(ar.members[i].name, opt->paths[j]);
+    }
+    if(!found){
+      fprintf(stderr, "Error: %s is not in the archive.\n", opt->paths[j]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if(opt->list){
+    for(i = 0; i < ar.count; i++){
+      if(ar.members[i].selected){
+        printf("%12" PRIu64 " %12" PRIu64 "  %s\n", ar.members[i].size,
+               ar.members[i].csize, ar.members[i].name);
+      }
+    }
+  }
+  else if(ar.count > 0){
+    pthread_mutex_init(&ar.lock, 0);
+    pthread_mutex_init(&ar.outlock, 0);
+
+    //the members were all written with the same parameters, so the first
+    //one's header is enough to fit the threads into the memory budget
+    if(opt->maxmemory){
+      BitReader br;
+      struct archiveworker probe = {.ar = &ar, .offset = ar.members[0].offset,
+                                    .left = ar.members[0].csize};
+      br = bitReaderCreate(memberSource, &probe);
+      if(decoderReadHeader(br, &streamopt) != 0) streamopt.maxbits = MIN_MAXBITS;
+      bitReaderDestroy(br);
+    }
+    else{
+      streamopt.maxbits = MIN_MAXBITS;
+    }
+
+    runThreads(&ar, archiveThreads(opt, &streamopt, ar.count), extractThread,
+               extractSink);
+
+    if(opt->scan){
+      for(i = 0; i < ar.count; i++){
+        if(ar.members[i].selected){
+          printf("%" PRIu64 " %s\n", ar.members[i].size, ar.members[i].name);
+        }
+      }
+    }
+  }
+
+  for(i = 0; i < ar.count; i++){
+    free(ar.members[i].name);
+  }
+  free(ar.members);
+}
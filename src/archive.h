@@ -0,0 +1,52 @@
+/*
+archive.h
+contains declarations for archives, which hold many files compressed
+independently in one container
+
+An archive starts with the magic "LZWA" and a version byte. Then come the
+members, each a complete compressed stream with its own header, in whatever
+order they were finished. The central directory follows, with one entry per
+member:
+
+  offset (8 bytes), compressed length (8), original length (8),
+  mode (4), modification time (8), name length (4), name
+
+and the archive ends with a trailer holding the offset of the directory (8
+bytes), the number of members (8) and the magic again. All numbers are little
+endian. The directory lets any member be found without reading the others.
+*/
+
+#define ARCHIVE_MAGIC "LZWA"     //the first and last bytes of an archive
+#define ARCHIVE_VERSION (1)      //the format version after the magic
+
+// -----------------------------------------------------------------------------
+// void archiveCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   writes an archive of files to stdout. Directories are added with all the
+//   regular files below them; leading "/", "./" and "../" are removed from
+//   the names stored. The members are compressed in parallel, with each
+//   thread reusing its string table and buffers from one member to the next.
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the encoding
+//                  parameters, the paths to add, the file list to read more
+//                  paths from, and the number of threads
+
+void archiveCreate(Options* opt);
+
+// -----------------------------------------------------------------------------
+// void archiveExtract
+// -----------------------------------------------------------------------------
+// Description:
+//   lists, checks or extracts the members of an archive. Members are decoded
+//   in parallel, reading them directly from their offsets, so the archive must
+//   be a seekable file. Extracted files are created below the current
+//   directory with their saved mode and modification time.
+// Parameters:
+//   Options* opt - a pointer to an options struct. If paths are given only
+//                  the members with those names, or below those directories,
+//                  are used. list prints the directory without decoding, and
+//                  scan checks the members without writing them.
+//   int fd - the archive, whose magic has already been read
+
+void archiveExtract(Options* opt, int fd);
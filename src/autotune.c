@@ -0,0 +1,216 @@
+/*
+autotune.c
+contains implementation code for picking the encoding parameters
+automatically, by compressing samples of the input with a set of candidate
+parameters in parallel and keeping the best one
+*/
+
+#define _GNU_SOURCE
+#include "globals.h"
+#include "bitio.h"
+#include "encode.h"
+#include "budget.h"
+#include "autotune.h"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define AUTO_SAMPLES (4)              //number of samples taken from the input
+#define AUTO_SAMPLE_SIZE (1 << 19)    //bytes per sample
+#define AUTO_MAX_CANDIDATES (64)
+
+// -----------------------------------------------------------------------------
+// struct candidate
+// -----------------------------------------------------------------------------
+// Fields:
+//   Options opt - the parameters being tried
+//   uint64_t bytes - the compressed size of the sample
+//   double seconds - the cpu time taken to compress the sample
+
+struct candidate{
+  Options opt;
+  uint64_t bytes;
+  double seconds;
+};
+
+// -----------------------------------------------------------------------------
+// struct tuning
+// -----------------------------------------------------------------------------
+// Description:
+//   the work shared by the tuning threads
+// Fields:
+//   struct candidate* cands - the candidates to try
+//   int ncands - the number of candidates
+//   int next - the index of the next candidate nobody has taken yet
+//   pthread_mutex_t lock - protects next
+//   const unsigned char* sample, size_t n - the sample to compress
+
+struct tuning{
+  struct candidate* cands;
+  int ncands;
+  int next;
+  pthread_mutex_t lock;
+  const unsigned char* sample;
+  size_t n;
+};
+
+// -----------------------------------------------------------------------------
+// void* tuneWorker
+// -----------------------------------------------------------------------------
+// Description:
+//   a thread which compresses the sample with candidates until none are left
+// Parameters:
+//   void* arg - a pointer to the struct tuning
+// Return value:
+//   always a null pointer
+
+static void* tuneWorker(void* arg){
+  struct tuning* t = arg;
+  struct candidate* c;
+  struct timespec start, end;
+  Encoder enc;
+  BitWriter out;
+  int i;
+
+  for(;;){
+    pthread_mutex_lock(&t->lock);
+    i = t->next++;
+    pthread_mutex_unlock(&t->lock);
+    if(i >= t->ncands) break;
+
+    c = &t->cands[i];
+    c->bytes = 0;
+    out = bitWriterCreate(countSink, &c->bytes);
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    enc = encoderCreate(&c->opt, out);
+    encoderWrite(enc, t->sample, t->n);
+    encoderFinish(enc);
+    encoderDestroy(enc);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+    c->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    bitWriterDestroy(out);
+  }
+
+  return 0;
+}
+
+void autoTune(Options* opt, const unsigned char* sample, size_t n){
+  static const int maxbitses[] = {10, 12, 14, 16, 18, 20};
+  struct candidate cands[AUTO_MAX_CANDIDATES];
+  struct tuning t = {.cands = cands, .ncands = 0, .next = 0,
+                     .sample = sample, .n = n};
+  uint64_t biggest = 0, minbytes = UINT64_MAX;
+  double minseconds = 1e300, score, bestscore = 1e300;
+  int i, m, w, e, nthreads, best = -1;
+  pthread_t* threads;
+  Options c;
+
+  //build the candidate list, keeping explicitly set parameters fixed
+  for(i = 0; i < (int)(sizeof(maxbitses) / sizeof(*maxbitses)); i++){
+    m = opt->maxbits ? opt->maxbits : maxbitses[i];
+    for(w = 0; w < 3; w++){
+      for(e = opt->escape; e < 2; e++){
+        c = *opt;
+        c.maxbits = m;
+        c.escape = e;
+        if(!opt->prune){
+          //no pruning, or a window of a quarter or all of the table
+          c.prune = w == 0 ? 0 : (int64_t)1 << (m - (w == 1 ? 2 : 0));
+        }
+        if(opt->maxmemory && memoryFootprint(&c) > opt->maxmemory) continue;
+        if(memoryFootprint(&c) > biggest) biggest = memoryFootprint(&c);
+        cands[t.ncands++].opt = c;
+      }
+      if(opt->prune) break;
+    }
+    if(opt->maxbits) break;
+  }
+
+  if(t.ncands == 0){
+    fprintf(stderr, "Error: --max-memory is too small for --auto.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  //one thread per processor, but only as many tables as fit in memory at once
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(opt->maxmemory && (uint64_t)nthreads * biggest > opt->maxmemory){
+    nthreads = opt->maxmemory / biggest;
+  }
+  if(nthreads > t.ncands) nthreads = t.ncands;
+  if(nthreads < 1) nthreads = 1;
+
+  pthread_mutex_init(&t.lock, 0);
+  threads = malloc(nthreads * sizeof(*threads));
+  for(i = 0; i < nthreads; i++){
+    pthread_create(&threads[i], 0, tuneWorker, &t);
+  }
+  for(i = 0; i < nthreads; i++){
+    pthread_join(threads[i], 0);
+  }
+  free(threads);
+  pthread_mutex_destroy(&t.lock);
+
+  for(i = 0; i < t.ncands; i++){
+    if(cands[i].bytes < minbytes) minbytes = cands[i].bytes;
+    if(cands[i].seconds < minseconds) minseconds = cands[i].seconds;
+  }
+  if(minseconds <= 0) minseconds = 1e-9;
+
+  for(i = 0; i < t.ncands; i++){
+    score = (1 - opt->autoweight) * cands[i].bytes / (double)minbytes
+            + opt->autoweight * cands[i].seconds / minseconds;
+    if(score < bestscore){
+      bestscore = score;
+      best = i;
+    }
+  }
+
+  opt->maxbits = cands[best].opt.maxbits;
+  opt->prune = cands[best].opt.prune;
+  opt->escape = cands[best].opt.escape;
+
+  fprintf(stderr, "auto: -m %d", opt->maxbits);
+  if(opt->prune) fprintf(stderr, " -p %" PRId64, opt->prune);
+  if(opt->escape) fprintf(stderr, " -e");
+  fprintf(stderr, " (%d candidates, sample of %zu bytes to %" PRIu64
+          " bytes, %.1f MB/s)\n", t.ncands, n, cands[best].bytes,
+          cands[best].seconds > 0 ? n / cands[best].seconds / 1e6 : 0.0);
+}
+
+void autoTuneFile(Options* opt, FILE* in, unsigned char** head,
+                  size_t* headlen){
+  unsigned char* sample = malloc(AUTO_SAMPLES * AUTO_SAMPLE_SIZE);
+  size_t n = 0;
+  struct stat st;
+  off_t start, span;
+  ssize_t got;
+  int i;
+
+  *head = 0;
+  *headlen = 0;
+
+  start = ftello(in);
+  if(fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) && start >= 0
+     && st.st_size - start > AUTO_SAMPLES * AUTO_SAMPLE_SIZE){
+    //spread the samples evenly over the rest of the file
+    span = st.st_size - start - AUTO_SAMPLE_SIZE;
+    for(i = 0; i < AUTO_SAMPLES; i++){
+      got = pread(fileno(in), sample + n, AUTO_SAMPLE_SIZE,
+                  start + span / (AUTO_SAMPLES - 1) * i);
+      if(got > 0) n += got;
+    }
+  }
+  else{
+    //the input can't be sampled in place, so its first bytes are kept
+    n = fread(sample, 1, AUTO_SAMPLES * AUTO_SAMPLE_SIZE, in);
+    *head = sample;
+    *headlen = n;
+  }
+
+  autoTune(opt, sample, n);
+
+  if(*head == 0) free(sample);
+}
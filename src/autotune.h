@@ -0,0 +1,46 @@
+/*
+autotune.h
+contains declarations for picking the encoding parameters automatically, by
+compressing samples of the input with a set of candidate parameters in
+parallel and keeping the best one
+*/
+
+// -----------------------------------------------------------------------------
+// void autoTune
+// -----------------------------------------------------------------------------
+// Description:
+//   compresses a sample with every candidate parameter set, in as many threads
+//   as there are processors, and keeps the one which scores best.
+//   The score weighs compressed size against compression time by
+//   opt->autoweight (0 only counts size, 1 only counts time), each relative
+//   to the best candidate. Parameters set explicitly (a nonzero maxbits or
+//   window, or escape set) are kept fixed, and candidates which don't fit in
+//   opt->maxmemory are skipped.
+// Parameters:
+//   Options* opt - a pointer to an options struct to tune
+//   const unsigned char* sample - the sample to compress
+//   size_t n - the number of bytes in the sample
+// External state:
+//   modifies the maxbits, prune and escape fields of the options struct, and
+//   describes the chosen parameters on stderr
+
+void autoTune(Options* opt, const unsigned char* sample, size_t n);
+
+// -----------------------------------------------------------------------------
+// void autoTuneFile
+// -----------------------------------------------------------------------------
+// Description:
+//   samples a file and tunes the parameters with autoTune. Regular files are
+//   sampled at several offsets without moving the file position. Other files
+//   (pipes, sockets) are sampled by reading their first bytes, which are then
+//   returned so the caller can encode them before the rest of the file.
+// Parameters:
+//   Options* opt - a pointer to an options struct to tune
+//   FILE* in - the file to sample
+//   unsigned char** head - set to the bytes read from in, or a null pointer
+//   size_t* headlen - set to the number of bytes in *head
+// External state:
+//   modifies the options struct, and may read from in
+
+void autoTuneFile(Options* opt, FILE* in, unsigned char** head,
+                  size_t* headlen);
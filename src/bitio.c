@@ -5,54 +5,250 @@ contains implementation code for bit I/O
 by Geoffrey Litt
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
 #include "bitio.h"
+#include "probes.h"
 
-//sendRemainingBits needs these variables at the end
-static int numOverflow = 0;
-static unsigned int overflow = 0;
+#define BITIO_BUFSIZE (1 << 16)   //bytes buffered between sink/source calls
 
-void putBits (int nBits, int code)
+// -----------------------------------------------------------------------------
+// struct bitwriter
+// -----------------------------------------------------------------------------
+// Fields:
+//   int numOverflow - the number of bits waiting in overflow
+//   uint64_t overflow - bits not yet making up a whole byte. 64 bits wide so
+//                       that codes of up to MAX_MAXBITS bits can be added while
+//                       up to CHAR_BIT - 1 bits are still pending
+//   ByteSink sink - the function receiving whole bytes
+//   void* ctx - the context pointer for sink
+//   uint64_t flushed - the number of bytes already handed to sink
+//   size_t pos - the number of bytes in buf
+//   unsigned char buf[] - bytes not yet handed to sink
+
+struct bitwriter{
+  int numOverflow;
+  uint64_t overflow;
+  ByteSink sink;
+  void* ctx;
+  uint64_t flushed;
+  size_t pos;
+  unsigned char buf[BITIO_BUFSIZE];
+};
+
+// -----------------------------------------------------------------------------
+// struct bitreader
+// -----------------------------------------------------------------------------
+// Fields:
+//   int numOverflow - the number of bits waiting in overflow
+//   uint64_t overflow - bits read but not yet returned by getBits
+//   ByteSource source - the function supplying bytes
+//   void* ctx - the context pointer for source
+//   size_t pos - the index of the next unread byte in buf
+//   size_t len - the number of bytes in buf
+//   uint64_t fetched - the number of bytes taken from source so far
+//   unsigned char buf[] - bytes taken from source
+
+struct bitreader{
+  int numOverflow;
+  uint64_t overflow;
+  ByteSource source;
+  void* ctx;
+  uint64_t fetched;
+  size_t pos;
+  size_t len;
+  unsigned char buf[BITIO_BUFSIZE];
+};
+
+size_t fileSink(void* ctx, const unsigned char* buf, size_t n){
+  return fwrite(buf, 1, n, (FILE*)ctx);
+}
+
+size_t fileSource(void* ctx, unsigned char* buf, size_t n){
+  return fread(buf, 1, n, (FILE*)ctx);
+}
+
+size_t fdSource(void* ctx, unsigned char* buf, size_t n){
+  ssize_t got;
+
+  do{
+    got = read(*(int*)ctx, buf, n);
+  } while(got < 0 && errno == EINTR);
+
+  if(got < 0){
+    fprintf(stderr, "Error: could not read input\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return got;
+}
+
+size_t fdSink(void* ctx, const unsigned char* buf, size_t n){
+  size_t done = 0;
+  ssize_t put;
+
+  while(done < n){
+    put = write(*(int*)ctx, buf + done, n - done);
+    if(put < 0 && errno == EINTR) continue;
+    if(put <= 0) break;
+    done += put;
+  }
+
+  return done;
+}
+
+size_t countSink(void* ctx, const unsigned char* buf, size_t n){
+  (void)buf;
+  if(ctx) *(uint64_t*)ctx += n;
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void flushBuffer
+// -----------------------------------------------------------------------------
+// Description:
+//   hands the buffered bytes of a BitWriter to its sink
+// Parameters:
+//   BitWriter bw - the BitWriter to flush
+
+static void flushBuffer(BitWriter bw){
+  PROBE2(flush, bw->pos, bw->flushed);
+  if(bw->pos != 0 && bw->sink(bw->ctx, bw->buf, bw->pos) != bw->pos){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+  bw->flushed += bw->pos;
+  bw->pos = 0;
+}
+
+BitWriter bitWriterCreate(ByteSink sink, void* ctx){
+  BitWriter bw = malloc(sizeof(*bw));
+
+  bw->numOverflow = 0;
+  bw->overflow = 0;
+  bw->sink = sink;
+  bw->ctx = ctx;
+  bw->flushed = 0;
+  bw->pos = 0;
+
+  return bw;
+}
+
+void bitWriterDestroy(BitWriter bw){
+  free(bw);
+}
+
+void bitWriterReset(BitWriter bw){
+  bw->numOverflow = 0;
+  bw->overflow = 0;
+  bw->pos = 0;
+}
+
+void putBits (BitWriter bw, int nBits, int code)
 {
   unsigned int c;
 
-  numOverflow += nBits;
-  code &= (1 << nBits) - 1;
+  bw->numOverflow += nBits;
+  bw->overflow = (bw->overflow << nBits)
+                 | ((unsigned int)code & ((1u << nBits) - 1));
+  while (bw->numOverflow >= CHAR_BIT) {
+  	bw->numOverflow -= CHAR_BIT;
+  	c = bw->overflow >> bw->numOverflow;
+  	bw->buf[bw->pos++] = c;
+  	if (bw->pos == BITIO_BUFSIZE) flushBuffer(bw);
+  	bw->overflow = bw->overflow ^ ((uint64_t)c << bw->numOverflow); //bitwise xor
+  }
+}
 
-  overflow = (overflow << nBits) | code;
-  while (numOverflow >= CHAR_BIT) { 
-  	numOverflow -= CHAR_BIT; 
-  	c = overflow >> numOverflow;
-  	putchar (c);
-  	overflow = overflow ^ (c << numOverflow); //bitwise xor
+void putByte (BitWriter bw, int c)
+{
+  if (bw->numOverflow != 0){
+    putBits(bw, CHAR_BIT, c);
+    return;
   }
+  bw->buf[bw->pos++] = c;
+  if (bw->pos == BITIO_BUFSIZE) flushBuffer(bw);
 }
 
-void sendRemainingBits (void)
+void padBits (BitWriter bw)
 {
-  char c;
-  if (numOverflow != 0){
-    c = overflow << (CHAR_BIT - numOverflow);
-  	putchar(c);
+  if (bw->numOverflow != 0){
+    putBits(bw, CHAR_BIT - bw->numOverflow, 0);
   }
 }
 
-int getBits (int nBits)
+void sendRemainingBits (BitWriter bw)
+{
+  padBits(bw);
+  flushBuffer(bw);
+}
+
+uint64_t bytesWritten(BitWriter bw){
+  return bw->flushed + bw->pos;
+}
+
+BitReader bitReaderCreate(ByteSource source, void* ctx){
+  BitReader br = malloc(sizeof(*br));
+
+  br->numOverflow = 0;
+  br->overflow = 0;
+  br->source = source;
+  br->ctx = ctx;
+  br->fetched = 0;
+  br->pos = 0;
+  br->len = 0;
+
+  return br;
+}
+
+void bitReaderDestroy(BitReader br){
+  free(br);
+}
+
+void bitReaderReset(BitReader br){
+  br->numOverflow = 0;
+  br->overflow = 0;
+  br->fetched = 0;
+  br->pos = 0;
+  br->len = 0;
+}
+
+int getBits (BitReader br, int nBits)
 {
     int c;
-    static int numOverflow = 0;
-    static int unsigned overflow = 0;
-                        
-    while (numOverflow < nBits) {
-      if ((c = getchar()) == EOF){
-        return EOF;
+
+    while (br->numOverflow < nBits) {
+      if (br->pos == br->len){
+        br->pos = 0;
+        if ((br->len = br->source(br->ctx, br->buf, BITIO_BUFSIZE)) == 0){
+          return EOF;
+        }
+        br->fetched += br->len;
       }
-      numOverflow += CHAR_BIT;
-      overflow = (overflow << CHAR_BIT) | c;
+      c = br->buf[br->pos++];
+      br->numOverflow += CHAR_BIT;
+      br->overflow = (br->overflow << CHAR_BIT) | c;
     }
-    numOverflow -= nBits;
-    c = overflow >> numOverflow;
-    overflow = overflow ^ (c << numOverflow);
+    br->numOverflow -= nBits;
+    c = br->overflow >> br->numOverflow;
+    br->overflow = br->overflow ^ ((uint64_t)c << br->numOverflow);
     return c;
-}
\ No newline at end of file
+}
+
+int skipPadding (BitReader br)
+{
+    int padding = br->overflow >> (br->numOverflow - br->numOverflow % CHAR_BIT);
+
+    br->numOverflow -= br->numOverflow % CHAR_BIT;
+    br->overflow &= ((uint64_t)1 << br->numOverflow) - 1;
+    return padding;
+}
+
+uint64_t bitsRead (BitReader br)
+{
+    return (br->fetched - (br->len - br->pos)) * CHAR_BIT - br->numOverflow;
+}
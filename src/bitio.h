@@ -2,36 +2,240 @@
 bitio.h
 contains function declaration for bit I/O
 
+Bits are written to a BitWriter and read from a BitReader, which buffer whole
+bytes and hand them to (or take them from) a ByteSink or ByteSource. Each
+stream keeps its own state, so any number can be used at once.
+
 by Geoffrey Litt
 */
 
 #include <limits.h>
 
+// -----------------------------------------------------------------------------
+// size_t ByteSink
+// -----------------------------------------------------------------------------
+// Description:
+//   a function that consumes bytes written to a BitWriter
+// Parameters:
+//   void* ctx - the context pointer given to bitWriterCreate
+//   const unsigned char* buf - the bytes to consume
+//   size_t n - the number of bytes in buf
+// Return value:
+//   the number of bytes consumed, anything less than n is a write error
+
+typedef size_t (*ByteSink)(void* ctx, const unsigned char* buf, size_t n);
+
+// -----------------------------------------------------------------------------
+// size_t ByteSource
+// -----------------------------------------------------------------------------
+// Description:
+//   a function that supplies bytes to a BitReader
+// Parameters:
+//   void* ctx - the context pointer given to bitReaderCreate
+//   unsigned char* buf - the buffer to fill
+//   size_t n - the size of buf
+// Return value:
+//   the number of bytes supplied, 0 at the end of the input
+
+typedef size_t (*ByteSource)(void* ctx, unsigned char* buf, size_t n);
+
+typedef struct bitwriter *BitWriter;
+typedef struct bitreader *BitReader;
+
+// -----------------------------------------------------------------------------
+// size_t fileSink, fileSource
+// -----------------------------------------------------------------------------
+// Description:
+//   a ByteSink and a ByteSource for stdio files, ctx is the FILE*
+
+size_t fileSink(void* ctx, const unsigned char* buf, size_t n);
+size_t fileSource(void* ctx, unsigned char* buf, size_t n);
+
+// -----------------------------------------------------------------------------
+// size_t fdSource
+// -----------------------------------------------------------------------------
+// Description:
+//   a ByteSource for file descriptors, ctx is a pointer to the int descriptor.
+//   Unlike fileSource it returns whatever bytes are available rather than
+//   waiting for a whole buffer, so it is used where latency matters.
+
+size_t fdSource(void* ctx, unsigned char* buf, size_t n);
+
+// -----------------------------------------------------------------------------
+// size_t fdSink
+// -----------------------------------------------------------------------------
+// Description:
+//   a ByteSink for file descriptors, ctx is a pointer to the int descriptor.
+//   It writes without stdio buffering, retrying partial writes.
+
+size_t fdSink(void* ctx, const unsigned char* buf, size_t n);
+
+// -----------------------------------------------------------------------------
+// size_t countSink
+// -----------------------------------------------------------------------------
+// Description:
+//   a ByteSink which throws the bytes away, ctx may be a null pointer or a
+//   uint64_t* that the number of bytes is added to
+
+size_t countSink(void* ctx, const unsigned char* buf, size_t n);
+
+// -----------------------------------------------------------------------------
+// BitWriter bitWriterCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   creates a new BitWriter
+// Parameters:
+//   ByteSink sink - the function that receives the written bytes
+//   void* ctx - a context pointer passed to sink
+// Return value:
+//   a new BitWriter
+
+BitWriter bitWriterCreate(ByteSink sink, void* ctx);
+
+// -----------------------------------------------------------------------------
+// void bitWriterDestroy
+// -----------------------------------------------------------------------------
+// Description:
+//   frees a BitWriter. Bytes still buffered are not written, so
+//   sendRemainingBits should be called first.
+// Parameters:
+//   BitWriter bw - the BitWriter to destroy
+
+void bitWriterDestroy(BitWriter bw);
+
+// -----------------------------------------------------------------------------
+// void bitWriterReset
+// -----------------------------------------------------------------------------
+// Description:
+//   throws away any bits and bytes a BitWriter has not handed to its sink, so
+//   that it can start a new stream, for example after the sink failed
+// Parameters:
+//   BitWriter bw - the BitWriter to reset
+
+void bitWriterReset(BitWriter bw);
+
 // -----------------------------------------------------------------------------
 // void putBits
 // -----------------------------------------------------------------------------
 // Description:
-//   writes a code to stdout
+//   writes a code to a BitWriter
 // Parameters:
+//   BitWriter bw - the BitWriter to write to
 //   int nbits - the number of bits that should be used to represent the code
 //   int code - the code being sent
 
-void putBits(int nBits, int code);
+void putBits(BitWriter bw, int nBits, int code);
 
 // -----------------------------------------------------------------------------
-// void sendRemainingBits
+// void putByte
 // -----------------------------------------------------------------------------
 // Description:
-//   writes any bits left over after all calls to putBits to stdout
+//   writes a byte to a BitWriter, the same as putBits(bw, CHAR_BIT, c) but
+//   faster when the BitWriter is byte aligned
+// Parameters:
+//   BitWriter bw - the BitWriter to write to
+//   int c - the byte being sent
 
-void sendRemainingBits (void);
+void putByte(BitWriter bw, int c);
 
 // -----------------------------------------------------------------------------
 // void sendRemainingBits
 // -----------------------------------------------------------------------------
 // Description:
-//   reads nbits bits from stdin and returns the corresponding code
+//   writes any bits left over after all calls to putBits, padded with zeros
+//   to a whole byte, and hands all buffered bytes to the sink
+// Parameters:
+//   BitWriter bw - the BitWriter to flush
+
+void sendRemainingBits(BitWriter bw);
+
+// -----------------------------------------------------------------------------
+// void padBits
+// -----------------------------------------------------------------------------
+// Description:
+//   pads the bits written so far with zeros to a whole byte
+// Parameters:
+//   BitWriter bw - the BitWriter to pad
+
+void padBits(BitWriter bw);
+
+// -----------------------------------------------------------------------------
+// uint64_t bytesWritten
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the number of whole bytes written to a BitWriter so far,
+//   including bytes that are still buffered
 // Parameters:
+//   BitWriter bw - the BitWriter to examine
+
+uint64_t bytesWritten(BitWriter bw);
+
+// -----------------------------------------------------------------------------
+// BitReader bitReaderCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   creates a new BitReader
+// Parameters:
+//   ByteSource source - the function that supplies the bytes to read
+//   void* ctx - a context pointer passed to source
+// Return value:
+//   a new BitReader
+
+BitReader bitReaderCreate(ByteSource source, void* ctx);
+
+// -----------------------------------------------------------------------------
+// void bitReaderDestroy
+// -----------------------------------------------------------------------------
+// Description:
+//   frees a BitReader
+// Parameters:
+//   BitReader br - the BitReader to destroy
+
+void bitReaderDestroy(BitReader br);
+
+// -----------------------------------------------------------------------------
+// void bitReaderReset
+// -----------------------------------------------------------------------------
+// Description:
+//   throws away any bits and bytes a BitReader has buffered, so that it can
+//   read a new stream from its source. bitsRead starts again from zero.
+// Parameters:
+//   BitReader br - the BitReader to reset
+
+void bitReaderReset(BitReader br);
+
+// -----------------------------------------------------------------------------
+// int getBits
+// -----------------------------------------------------------------------------
+// Description:
+//   reads nbits bits from a BitReader and returns the corresponding code
+// Parameters:
+//   BitReader br - the BitReader to read from
 //   int nbits - the number of bits to read
+// Return value:
+//   the code read, or EOF if the input ran out
+
+int getBits(BitReader br, int nBits);
+
+// -----------------------------------------------------------------------------
+// int skipPadding
+// -----------------------------------------------------------------------------
+// Description:
+//   throws away the unread bits of the current byte, so that the next call to
+//   getBits starts at a byte boundary
+// Parameters:
+//   BitReader br - the BitReader to skip in
+// Return value:
+//   the value of the bits thrown away, which is 0 for real padding
+
+int skipPadding(BitReader br);
+
+// -----------------------------------------------------------------------------
+// uint64_t bitsRead
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the number of bits returned by (or skipped in) a BitReader so far
+// Parameters:
+//   BitReader br - the BitReader to examine
 
-int getBits (int nBits);
\ No newline at end of file
+uint64_t bitsRead(BitReader br);
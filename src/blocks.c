@@ -0,0 +1,438 @@
+/*
+blocks.c
+contains implementation code for block mode
+*/
+
+#include "globals.h"
+#include "bitio.h"
+#include "encode.h"
+#include "decode.h"
+#include "budget.h"
+#include "blocks.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define BLOCKS_SIZE (1 << 23)     //input bytes compressed per block
+
+// -----------------------------------------------------------------------------
+// struct block
+// -----------------------------------------------------------------------------
+// Description:
+//   a slot holding one block of the input while it is compressed
+// Fields:
+//   unsigned char* data - the input bytes of the block
+//   size_t len - the number of bytes in data
+//   unsigned char* packed - the compressed stream of the block
+//   size_t packedlen - the number of bytes in packed
+//   size_t packedcap - the number of bytes allocated for packed
+//   int done - 1 once packed holds the whole compressed stream
+
+struct block{
+  unsigned char* data;
+  size_t len;
+  unsigned char* packed;
+  size_t packedlen;
+  size_t packedcap;
+  int done;
+};
+
+// -----------------------------------------------------------------------------
+// struct blocks
+// -----------------------------------------------------------------------------
+// Description:
+//   the state shared by the reading and writing thread and the workers
+// Fields:
+//   Options* opt - the encoding parameters
+//   struct block* slots - a ring of blocks being compressed
+//   int nslots - the number of slots
+//   uint64_t read - the number of blocks read so far
+//   uint64_t taken - the number of blocks taken by workers so far
+//   int eof - 1 once the whole input has been read
+//   EncoderStats total - the statistics of all the blocks compressed
+//   pthread_mutex_t lock - protects everything above except opt and slots'
+//                          bytes
+//   pthread_cond_t filled - signalled when a block is read or the input ends
+//   pthread_cond_t finished - signalled when a block is compressed
+
+struct blocks{
+  Options* opt;
+  struct block* slots;
+  int nslots;
+  uint64_t read;
+  uint64_t taken;
+  int eof;
+  EncoderStats total;
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t finished;
+};
+
+// -----------------------------------------------------------------------------
+// struct blockworker
+// -----------------------------------------------------------------------------
+// Description:
+//   a worker thread, with the Encoder it reuses for each block
+// Fields:
+//   struct blocks* b - the blocks the worker takes from
+//   struct block* cur - the block being compressed
+//   Encoder enc - created for the first block, and reset for each later one
+//   BitWriter out - writes the compressed stream to cur's packed bytes
+
+struct blockworker{
+  struct blocks* b;
+  struct block* cur;
+  Encoder enc;
+  BitWriter out;
+};
+
+// -----------------------------------------------------------------------------
+// size_t packedSink
+// -----------------------------------------------------------------------------
+// Description:
+//   a ByteSink which appends to the packed bytes of a worker's current block,
+//   ctx is the struct blockworker*
+
+static size_t packedSink(void* ctx, const unsigned char* buf, size_t n){
+  struct block* blk = ((struct blockworker*)ctx)->cur;
+
+  if(blk->packedlen + n > blk->packedcap){
+    blk->packedcap = blk->packedlen + n > 2 * blk->packedcap
+                     ? blk->packedlen + n : 2 * blk->packedcap;
+    blk->packed = realloc(blk->packed, blk->packedcap);
+  }
+  memcpy(blk->packed + blk->packedlen, buf, n);
+  blk->packedlen += n;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void* compressThread
+// -----------------------------------------------------------------------------
+// Description:
+//   compresses blocks as they are read, until the input ends
+// Parameters:
+//   void* arg - the struct blockworker*
+
+static void* compressThread(void* arg){
+  struct blockworker* w = arg;
+  struct blocks* b = w->b;
+  EncoderStats stats;
+
+  pthread_mutex_lock(&b->lock);
+  for(;;){
+    while(b->taken == b->read && !b->eof){
+      pthread_cond_wait(&b->filled, &b->lock);
+    }
+    if(b->taken == b->read) break;
+    w->cur = &b->slots[b->taken++ % b->nslots];
+    pthread_mutex_unlock(&b->lock);
+
+    w->cur->packedlen = 0;
+    if(w->enc){
+      encoderReset(w->enc, b->opt);
+    }
+    else{
+      w->enc = encoderCreate(b->opt, w->out);
+    }
+    encoderWrite(w->enc, w->cur->data, w->cur->len);
+    encoderFinish(w->enc);
+    encoderStats(w->enc, &stats);
+
+    pthread_mutex_lock(&b->lock);
+    b->total.bytesin += stats.bytesin;
+    b->total.bytesout += stats.bytesout;
+    b->total.codes += stats.codes;
+    b->total.escapes += stats.escapes;
+    b->total.prunes += stats.prunes;
+    b->total.lookups += stats.lookups;
+    b->total.hits += stats.hits;
+    w->cur->done = 1;
+    pthread_cond_broadcast(&b->finished);
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// size_t readBlock
+// -----------------------------------------------------------------------------
+// Description:
+//   reads the next block of the input
+// Parameters:
+//   ByteSource in - the function supplying the input
+//   void* ctx - the context pointer for in
+//   unsigned char* data - where the block is stored, BLOCKS_SIZE bytes long
+// Return value:
+//   the number of bytes read, less than BLOCKS_SIZE only at the end of the
+//   input
+
+static size_t readBlock(ByteSource in, void* ctx, unsigned char* data){
+  size_t n, got;
+
+  for(n = 0; n < BLOCKS_SIZE && (got = in(ctx, data + n, BLOCKS_SIZE - n)) > 0;
+      n += got);
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void plainEncode
+// -----------------------------------------------------------------------------
+// Description:
+//   writes an input of at most one block to stdout as a plain stream, without
+//   the block container, so that any decoder reads it
+// Parameters:
+//   Options* opt - the encoding parameters
+//   unsigned char* data - the whole input
+//   size_t len - the number of bytes in data
+
+static void plainEncode(Options* opt, unsigned char* data, size_t len){
+  BitWriter out = bitWriterCreate(fileSink, stdout);
+  Encoder enc = encoderCreate(opt, out);
+  EncoderStats stats;
+
+  encoderWrite(enc, data, len);
+  encoderFinish(enc);
+  if(fflush(stdout) != 0){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+  if(opt->stats){
+    encoderStats(enc, &stats);
+    printEncoderStats(stderr, &stats);
+  }
+
+  encoderDestroy(enc);
+  bitWriterDestroy(out);
+}
+
+void blocksEncode(Options* opt, ByteSource in, void* ctx){
+  struct blocks b = {.opt = opt, .read = 0, .taken = 0, .eof = 0};
+  int nthreads = threadsInBudget(opt, opt), i;
+  struct blockworker* workers;
+  pthread_t* threads;
+  uint64_t written = 0;
+  struct block* blk;
+  size_t n;
+
+  //blocks only pay off on several threads, one thread parses the whole input
+  //as a single plain stream
+  if(nthreads == 1){
+    encode(opt, in, ctx);
+    return;
+  }
+
+  //two slots per thread, so the next blocks are read while others compress
+  b.nslots = 2 * nthreads;
+  b.slots = calloc(b.nslots, sizeof(*b.slots));
+  for(i = 0; i < b.nslots; i++){
+    b.slots[i].data = malloc(BLOCKS_SIZE);
+  }
+
+  //an input of one block needs no container, so the first two are read
+  //before anything is written
+  b.slots[0].len = readBlock(in, ctx, b.slots[0].data);
+  if(b.slots[0].len == BLOCKS_SIZE){
+    b.slots[1].len = readBlock(in, ctx, b.slots[1].data);
+  }
+  if(b.slots[1].len == 0){
+    plainEncode(opt, b.slots[0].data, b.slots[0].len);
+    for(i = 0; i < b.nslots; i++){
+      free(b.slots[i].data);
+    }
+    free(b.slots);
+    return;
+  }
+  b.read = 2;
+  b.eof = b.slots[1].len < BLOCKS_SIZE;
+
+  workers = malloc(nthreads * sizeof(*workers));
+  threads = malloc(nthreads * sizeof(*threads));
+  memset(&b.total, 0, sizeof(b.total));
+  pthread_mutex_init(&b.lock, 0);
+  pthread_cond_init(&b.filled, 0);
+  pthread_cond_init(&b.finished, 0);
+
+  fputs(BLOCKS_MAGIC, stdout);
+  putchar(BLOCKS_VERSION);
+  writeNumber(stdout, BLOCKS_SIZE, 4);
+
+  for(i = 0; i < nthreads; i++){
+    workers[i].b = &b;
+    workers[i].enc = 0;
+    workers[i].out = bitWriterCreate(packedSink, &workers[i]);
+    if(pthread_create(&threads[i], 0, compressThread, &workers[i]) != 0){
+      fprintf(stderr, "Error: could not start block threads.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for(;;){
+    //read blocks into the free slots, only the last one may be short
+    while(!b.eof && b.read - written < (uint64_t)b.nslots){
+      blk = &b.slots[b.read % b.nslots];
+      n = readBlock(in, ctx, blk->data);
+      pthread_mutex_lock(&b.lock);
+      if(n > 0){
+        blk->len = n;
+        blk->done = 0;
+        b.read++;
+      }
+      if(n < BLOCKS_SIZE) b.eof = 1;
+      pthread_cond_broadcast(&b.filled);
+      pthread_mutex_unlock(&b.lock);
+    }
+    if(written == b.read) break;
+
+    //write the oldest block once it is compressed
+    blk = &b.slots[written % b.nslots];
+    pthread_mutex_lock(&b.lock);
+    while(!blk->done){
+      pthread_cond_wait(&b.finished, &b.lock);
+    }
+    pthread_mutex_unlock(&b.lock);
+    writeNumber(stdout, blk->packedlen, 4);
+    fwrite(blk->packed, 1, blk->packedlen, stdout);
+    written++;
+  }
+  writeNumber(stdout, 0, 4);
+
+  if(fflush(stdout) != 0){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = 0; i < nthreads; i++){
+    pthread_join(threads[i], 0);
+    if(workers[i].enc) encoderDestroy(workers[i].enc);
+    bitWriterDestroy(workers[i].out);
+  }
+  if(opt->stats){
+    printEncoderStats(stderr, &b.total);
+  }
+
+  for(i = 0; i < b.nslots; i++){
+    free(b.slots[i].data);
+    free(b.slots[i].packed);
+  }
+  free(b.slots);
+  free(threads);
+  free(workers);
+}
+
+// -----------------------------------------------------------------------------
+// struct packedsource
+// -----------------------------------------------------------------------------
+// Description:
+//   the context for packedSource, which supplies one block's compressed
+//   stream from memory
+// Fields:
+//   unsigned char* packed - the compressed stream
+//   size_t len - the number of bytes in packed
+//   size_t pos - the number of bytes of packed already supplied
+
+struct packedsource{
+  unsigned char* packed;
+  size_t len;
+  size_t pos;
+};
+
+static size_t packedSource(void* ctx, unsigned char* buf, size_t n){
+  struct packedsource* ps = ctx;
+
+  if(n > ps->len - ps->pos) n = ps->len - ps->pos;
+  memcpy(buf, ps->packed + ps->pos, n);
+  ps->pos += n;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void corrupt
+// -----------------------------------------------------------------------------
+// Description:
+//   reports a corrupt block stream and exits
+// Parameters:
+//   uint64_t block - the number of the block where the problem was found
+
+static void corrupt(uint64_t block){
+  fprintf(stderr, "Error: input file corrupted in block %" PRIu64 "\n", block);
+  exit(EXIT_FAILURE);
+}
+
+void blocksDecode(Options* opt, FILE* in){
+  struct packedsource ps = {.packed = 0, .len = 0, .pos = 0};
+  Options streamopt = {.maxbits = 0};
+  uint64_t size, len, block, produced, position, total = 0;
+  size_t cap = 0;
+  BitReader br = bitReaderCreate(packedSource, &ps);
+  BitWriter out = opt->scan ? 0 : bitWriterCreate(fileSink, stdout);
+  Decoder dec = 0;
+  int status, last = 0;
+
+  if(getc(in) != BLOCKS_VERSION || readNumber(in, &size, 4) != 0
+     || size == 0){
+    fprintf(stderr, "Error: input file corrupted at byte 4\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(block = 0; ; block++){
+    if(readNumber(in, &len, 4) != 0) corrupt(block);
+    if(len == 0) break;
+
+    //only the last block may be short
+    if(last) corrupt(block);
+    if(len > cap){
+      cap = len;
+      ps.packed = realloc(ps.packed, cap);
+    }
+    if(fread(ps.packed, 1, len, in) != len) corrupt(block);
+    ps.len = len;
+    ps.pos = 0;
+    bitReaderReset(br);
+
+    if(decoderReadHeader(br, &streamopt) != 0) corrupt(block);
+    if(opt->maxmemory && memoryFootprint(&streamopt) > opt->maxmemory){
+      fprintf(stderr, "Error: stream needs %" PRIu64 " bytes of memory, "
+              "more than --max-memory allows.\n", memoryFootprint(&streamopt));
+      exit(EXIT_FAILURE);
+    }
+    if(dec){
+      decoderReset(dec, &streamopt);
+    }
+    else{
+      dec = decoderCreate(&streamopt, br, out);
+    }
+
+    while((status = decoderRun(dec)) == DECODE_SYNC);
+    decoderProgress(dec, &produced, &position);
+    if(status == DECODE_CORRUPT || produced > size){
+      fprintf(stderr, "Error: input file corrupted in block %" PRIu64
+              " at bit %" PRIu64 " of its stream, after %" PRIu64 " bytes of "
+              "output\n", block, position, total + produced);
+      exit(EXIT_FAILURE);
+    }
+    last = produced < size;
+    total += produced;
+    if(out) sendRemainingBits(out);
+  }
+
+  if(getc(in) != EOF) corrupt(block);
+
+  if(out){
+    if(fflush(stdout) != 0){
+      fprintf(stderr, "Error: could not write output\n");
+      exit(EXIT_FAILURE);
+    }
+    bitWriterDestroy(out);
+  }
+  if(opt->scan){
+    printf("%" PRIu64 "\n", total);
+  }
+
+  if(dec) decoderDestroy(dec);
+  bitReaderDestroy(br);
+  free(ps.packed);
+}
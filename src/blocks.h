@@ -0,0 +1,46 @@
+/*
+blocks.h
+contains declarations for block mode, used by --best, which compresses blocks
+of the input as independent streams on several threads
+
+An input of more than one block, compressed on more than one thread, is
+written as a block stream, which only decoders with block mode can read. It
+starts with the magic "LZWB", a version byte and the block size
+(4 bytes, little endian). Each block of the input, the last one possibly
+shorter, follows as the length of its compressed stream (4 bytes, little
+endian) and the stream, which has its own header and string table. A length
+of 0 ends the stream.
+*/
+
+#define BLOCKS_MAGIC "LZWB"       //the first bytes of a block stream
+#define BLOCKS_VERSION (1)        //the format version after the magic
+
+// -----------------------------------------------------------------------------
+// void blocksEncode
+// -----------------------------------------------------------------------------
+// Description:
+//   compresses the input in blocks, on opt->threads threads or one per
+//   processor, and writes the block stream to stdout. The output is the same
+//   for any number of threads above one. With one thread, or an input of at
+//   most one block, a plain stream is written instead.
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the encoding
+//                  parameters used for every block
+//   ByteSource in - the function supplying the bytes to compress
+//   void* ctx - the context pointer for in
+
+void blocksEncode(Options* opt, ByteSource in, void* ctx);
+
+// -----------------------------------------------------------------------------
+// void blocksDecode
+// -----------------------------------------------------------------------------
+// Description:
+//   decompresses a block stream whose magic has already been read, and
+//   writes the result to stdout
+// Parameters:
+//   Options* opt - a pointer to an options struct. Streams needing more than
+//                  maxmemory are refused, and if scan is set the stream is
+//                  only checked, and its decompressed length printed.
+//   FILE* in - the block stream
+
+void blocksDecode(Options* opt, FILE* in);
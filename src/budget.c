@@ -0,0 +1,55 @@
+/*
+budget.c
+contains implementation code for estimating the memory used by the LZW
+encoder and decoder, and for fitting their parameters into a memory budget
+*/
+
+#include "globals.h"
+#include "budget.h"
+#include "hasharray.h"
+#include <unistd.h>
+
+uint64_t memoryFootprint(Options* opt){
+  int size = 1 << opt->maxbits;
+  uint64_t bytes = HashArrayFootprint(size);
+
+  if(opt->prune != 0){
+    //the pruned copy plus HashArrayPrune's map of old codes to new
+    bytes += HashArrayFootprint(size) + (uint64_t)size * sizeof(int);
+  }
+
+  if(opt->longmatch){
+    //the history plus the positions and long codes kept for each code
+    bytes += LONGMATCH_HISTORY
+             + (uint64_t)size * (sizeof(int64_t) + sizeof(int));
+  }
+
+  return bytes;
+}
+
+int threadsInBudget(Options* opt, Options* stream){
+  uint64_t footprint = memoryFootprint(stream);
+  long n = opt->threads;
+
+  if(n <= 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+  if(opt->maxmemory && (uint64_t)n * footprint > opt->maxmemory){
+    n = opt->maxmemory / footprint;
+  }
+  if(n < 1) n = 1;
+
+  return (int)n;
+}
+
+int fitMemoryBudget(Options* opt, uint64_t budget){
+  int maxbits = opt->maxbits;
+
+  while(memoryFootprint(opt) > budget){
+    if(opt->maxbits == MIN_MAXBITS){
+      opt->maxbits = maxbits;
+      return -1;
+    }
+    opt->maxbits--;
+  }
+
+  return opt->maxbits != maxbits;
+}
@@ -0,0 +1,51 @@
+/*
+budget.h
+contains declarations for estimating the memory used by the LZW encoder and
+decoder, and for fitting their parameters into a memory budget
+*/
+
+// -----------------------------------------------------------------------------
+// uint64_t memoryFootprint
+// -----------------------------------------------------------------------------
+// Description:
+//   computes the peak number of bytes the string tables take for a set of
+//   parameters. Pruning builds a new table before freeing the old one, so a
+//   nonzero window doubles the table memory. The escape flag only changes
+//   how full the table starts, not its size.
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the maxbits and
+//                  window values to estimate for
+// Return value:
+//   the peak memory footprint in bytes
+
+uint64_t memoryFootprint(Options* opt);
+
+// -----------------------------------------------------------------------------
+// int threadsInBudget
+// -----------------------------------------------------------------------------
+// Description:
+//   picks the number of threads for a mode which gives each thread its own
+//   string table: the number asked for, or one per processor, limited so
+//   that all their tables fit in the memory budget
+// Parameters:
+//   Options* opt - the options holding threads and maxmemory
+//   Options* stream - the parameters of the threads' streams
+// Return value:
+//   the number of threads, at least 1
+
+int threadsInBudget(Options* opt, Options* stream);
+
+// -----------------------------------------------------------------------------
+// int fitMemoryBudget
+// -----------------------------------------------------------------------------
+// Description:
+//   lowers maxbits until the memory footprint fits in a budget
+// Parameters:
+//   Options* opt - a pointer to an options struct whose maxbits is adjusted
+//   uint64_t budget - the maximum number of bytes that may be used
+// Return value:
+//   1 if maxbits was lowered, 0 if it already fit, -1 if nothing fits
+// External state:
+//   modifies the maxbits field of the options struct passed in
+
+int fitMemoryBudget(Options* opt, uint64_t budget);
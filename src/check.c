@@ -0,0 +1,145 @@
+/*
+check.c
+contains checks of edge cases that a round trip through encode and decode
+would take too much time or memory to reach, built and run by `make check`
+
+Each check prints a line saying what failed, and the program exits with a
+failure status if any did.
+*/
+
+#include "globals.h"
+#include "bitio.h"
+#include "encode.h"
+#include "decode.h"
+
+static int failures = 0;
+
+// -----------------------------------------------------------------------------
+// void expect
+// -----------------------------------------------------------------------------
+// Description:
+//   records the result of one check
+// Parameters:
+//   int ok - nonzero if the check passed
+//   const char* what - a description of the check, printed if it failed
+
+static void expect(int ok, const char* what){
+  if(!ok){
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// struct membuf
+// -----------------------------------------------------------------------------
+// Description:
+//   a buffer in memory that memSink appends to and memSource reads from
+// Fields:
+//   unsigned char* data - the bytes
+//   size_t len - the number of bytes in data
+//   size_t cap - the number of bytes allocated for data
+//   size_t pos - the number of bytes already read
+
+struct membuf{
+  unsigned char* data;
+  size_t len;
+  size_t cap;
+  size_t pos;
+};
+
+static size_t memSink(void* ctx, const unsigned char* buf, size_t n){
+  struct membuf* m = ctx;
+
+  if(m->len + n > m->cap){
+    m->cap = m->len + n > 2 * m->cap ? m->len + n : 2 * m->cap;
+    m->data = realloc(m->data, m->cap);
+  }
+  memcpy(m->data + m->len, buf, n);
+  m->len += n;
+
+  return n;
+}
+
+static size_t memSource(void* ctx, unsigned char* buf, size_t n){
+  struct membuf* m = ctx;
+
+  if(n > m->len - m->pos) n = m->len - m->pos;
+  memcpy(buf, m->data + m->pos, n);
+  m->pos += n;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void checkBitsToRepresent
+// -----------------------------------------------------------------------------
+// Description:
+//   checks code widths up to and past a full table at -m 30, where the
+//   encoder and decoder ask for the width of 2^30 + 1 codes
+
+static void checkBitsToRepresent(void){
+  expect(bitsToRepresent(2) == 1, "bitsToRepresent(2) == 1");
+  expect(bitsToRepresent(257) == 9, "bitsToRepresent(257) == 9");
+  expect(bitsToRepresent(1 << 24) == 24, "bitsToRepresent(2^24) == 24");
+  expect(bitsToRepresent((1 << 30) - 1) == 30,
+         "bitsToRepresent(2^30 - 1) == 30");
+  expect(bitsToRepresent(1 << 30) == 30, "bitsToRepresent(2^30) == 30");
+  expect(bitsToRepresent((1 << 30) + 1) == 31,
+         "bitsToRepresent(2^30 + 1) == 31");
+  expect(bitsToRepresent(INT_MAX) == 31, "bitsToRepresent(INT_MAX) == 31");
+}
+
+// -----------------------------------------------------------------------------
+// void checkHeader
+// -----------------------------------------------------------------------------
+// Description:
+//   checks that the largest window the extended header allows, whose high
+//   half has its top bit set, reads back unchanged
+
+static void checkHeader(void){
+  struct membuf m = {.data = 0, .len = 0, .cap = 0, .pos = 0};
+  Options opt = {.maxbits = 12, .prune = ((int64_t)1 << 48) - 1};
+  Options got = {.maxbits = 0};
+  BitWriter bw = bitWriterCreate(memSink, &m);
+  Encoder enc = encoderCreate(&opt, bw);
+  BitReader br;
+
+  encoderFinish(enc);
+  br = bitReaderCreate(memSource, &m);
+  expect(decoderReadHeader(br, &got) == 0, "extended header reads back");
+  expect(got.maxbits == opt.maxbits, "header keeps maxbits");
+  expect(got.prune == opt.prune, "header keeps a 48 bit window");
+
+  //a header cut off in the window is corrupt, not a negative shift
+  m.len = 3;
+  m.pos = 0;
+  bitReaderReset(br);
+  expect(decoderReadHeader(br, &got) == -1, "truncated header is corrupt");
+
+  encoderDestroy(enc);
+  bitWriterDestroy(bw);
+  bitReaderDestroy(br);
+  free(m.data);
+}
+
+// -----------------------------------------------------------------------------
+// int main
+// -----------------------------------------------------------------------------
+// Description:
+//   runs all the checks
+// Return values:
+//   0 - every check passed
+//   1 - some check failed
+
+int main(void){
+  checkBitsToRepresent();
+  checkHeader();
+
+  if(failures){
+    fprintf(stderr, "%d checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -5,54 +5,354 @@ contains the implementation of the LZW decoder
 by Geoffrey Litt
 */
 
+#define _GNU_SOURCE
 #include "globals.h"
+#include "bitio.h"
 #include "decode.h"
 #include "hasharray.h"
-#include "bitio.h"
 #include "stack.h"
+#include "budget.h"
+#include "archive.h"
+#include "fields.h"
+#include "filter.h"
+#include "blocks.h"
+#include "dedup.h"
+#include "lanes.h"
+#include "probes.h"
+#include <unistd.h>
+#include <errno.h>
+
+#define DECODE_MORE (2)   //a lane has more codes to decode
+#define NO_CODE (-2)      //no code is pending
+
+// -----------------------------------------------------------------------------
+// struct peeksource
+// -----------------------------------------------------------------------------
+// Description:
+//   the context for peekSource: the first bytes of the input, already read
+//   to check for a container magic, followed by the rest of the input
+// Fields:
+//   unsigned char head[] - the bytes already read
+//   size_t len - the number of bytes in head
+//   size_t pos - the number of bytes of head already supplied
+//   int fd - the descriptor the rest of the input comes from
 
-void decode(){
+struct peeksource{
+  unsigned char head[4];
+  size_t len;
+  size_t pos;
+  int fd;
+};
+
+// -----------------------------------------------------------------------------
+// struct decoder
+// -----------------------------------------------------------------------------
+// Description:
+//   the state of the decoding loop, kept between calls to decoderRun
+// Fields:
+//   int64_t window, int escape - the parameters from the stream header
+//   int nbits - the number of bits currently used for codes
+//   int oldcode - the previous code, EMPTY after an escape or sync
+//   int finalkar - the first char of the previous code's string
+//   int justpruned - 1 if the table was pruned since the previous code
+//   int64_t timer - the number of codes read so far, plus one
+//   HashArray st - the string table
+//   Stack kstack - a stack used to reverse the chars of a code's string
+//   uint64_t produced - the number of bytes decoded so far
+//   uint64_t position - the bit offset of the last code read
+//   BitReader in - the compressed stream
+//   BitWriter out - where the decompressed bytes are written, null to scan
+//   int step - 1 if decoderRun should return after the pending code, for
+//              decoderRunLanes
+//   int pending - a code read but not yet handled, else NO_CODE
+//   int adding - 1 if decoderRunLanes has decoded oldcode but not yet added
+//                its entry
+//   int addprefix - the code before oldcode, when adding
+
+struct decoder{
+  int64_t window;
+  int escape;
+  int nbits;
+  int oldcode;
+  int finalkar;
+  int justpruned;
+  int64_t timer;
+  HashArray st;
+  Stack kstack;
+  uint64_t produced;
+  uint64_t position;
+  BitReader in;
+  BitWriter out;
+  int step;
+  int pending;
+  int adding;
+  int addprefix;
+};
+
+int decoderReadHeader(BitReader in, Options* opt){
   //load option flags
-  int maxbits = getBits(BITS_TO_SEND_MAXBITS);
-  int window = getBits(BITS_TO_SEND_WINDOW);
-  int escape = getBits(BITS_TO_SEND_ESCAPE);
+  int maxbits = getBits(in, BITS_TO_SEND_MAXBITS);
+  int64_t window;
+  int escape, high, low;
 
-  if(maxbits <= CHAR_BIT || maxbits > 24){
-    fprintf(stderr,"Error: input file corrupted\n");
-    exit(EXIT_FAILURE);
+  if(maxbits != EOF && (maxbits & HEADER_EXTENDED)){
+    maxbits &= ~HEADER_EXTENDED;
+    high = getBits(in, BITS_TO_SEND_WINDOW_EXT / 2);
+    low = getBits(in, BITS_TO_SEND_WINDOW_EXT / 2);
+    window = high == EOF || low == EOF ? -1 : (int64_t)((uint64_t)high
+             << (BITS_TO_SEND_WINDOW_EXT / 2) | (uint64_t)low);
+  }
+  else{
+    window = getBits(in, BITS_TO_SEND_WINDOW);
+  }
+  escape = getBits(in, BITS_TO_SEND_ESCAPE);
+
+  if(maxbits < MIN_MAXBITS || maxbits > MAX_MAXBITS || window < 0
+     || escape == EOF){
+    return -1;
+  }
+
+  opt->maxbits = maxbits;
+  opt->prune = window;
+  opt->escape = escape;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// void startStream
+// -----------------------------------------------------------------------------
+// Description:
+//   sets up a Decoder for a new stream, but leaves the string table to the
+//   caller
+// Parameters:
+//   Decoder dec - the Decoder to set up
+//   Options* opt - a pointer to an options struct holding the header values
+
+static void startStream(Decoder dec, Options* opt){
+  dec->window = opt->prune;
+  dec->escape = opt->escape;
+  dec->oldcode = EMPTY;
+  dec->finalkar = 0;
+  dec->justpruned = 0;
+  dec->timer = 1;
+  dec->produced = 0;
+  dec->position = 0;
+  dec->pending = NO_CODE;
+  dec->adding = 0;
+
+  if(opt->escape){
+    dec->nbits = 3;
+  }
+  else{
+    dec->nbits = CHAR_BIT + 1;
   }
+}
+
+// -----------------------------------------------------------------------------
+// Decoder newDecoder
+// -----------------------------------------------------------------------------
+// Description:
+//   creates a decoder around a string table that is already allocated
+// Parameters:
+//   Options* opt - a pointer to an options struct holding the header values
+//   BitReader in - the compressed stream, after its header
+//   BitWriter out - where the decompressed bytes are written, null to scan
+//   HashArray st - an empty string table of the size opt->maxbits gives
+
+static Decoder newDecoder(Options* opt, BitReader in, BitWriter out,
+                          HashArray st){
+  Decoder dec = malloc(sizeof(*dec));
+
+  startStream(dec, opt);
+  dec->in = in;
+  dec->out = out;
+  dec->step = 0;
+  dec->st = st;
+  dec->kstack = stackCreate();
+
+  return dec;
+}
+
+Decoder decoderCreate(Options* opt, BitReader in, BitWriter out){
+  return newDecoder(opt, in, out,
+                    HashArrayCreate(1 << opt->maxbits, opt->escape));
+}
 
-  int code, oldcode, newcode, nbits;
-  int timer = 1;
-  int finalkar = 0;
-  int justpruned = 0;
+Decoder decoderTryCreate(Options* opt, BitReader in, BitWriter out){
+  HashArray st = HashArrayTryCreate(1 << opt->maxbits, opt->escape);
 
-  if(escape){
-    nbits = 3;
+  return st ? newDecoder(opt, in, out, st) : 0;
+}
+
+void decoderReset(Decoder dec, Options* opt){
+  startStream(dec, opt);
+
+  if(HashArraySize(dec->st) == 1 << opt->maxbits){
+    HashArrayReset(dec->st, opt->escape);
   }
   else{
-    nbits = CHAR_BIT + 1;
+    HashArrayDestroy(dec->st);
+    dec->st = HashArrayCreate(1 << opt->maxbits, opt->escape);
   }
+}
 
+// -----------------------------------------------------------------------------
+// int expandCode
+// -----------------------------------------------------------------------------
+// Description:
+//   writes the string of a code, or only counts it when scanning
+// Parameters:
+//   HashArray st - the string table
+//   Stack kstack - a stack used to reverse the chars of the string
+//   BitWriter out - where the string is written, null to scan
+//   int code - the code to decode
+//   int oldcode - the previous code, EMPTY after an escape or sync
+//   int* finalkar - the first char of the previous code's string, set to the
+//                   first char of this one
+//   uint64_t* produced - increased by the length of the string
+// Return value:
+//   0, or -1 if the code is not in the table
+
+static inline int expandCode(HashArray st, Stack kstack, BitWriter out,
+                             int code, int oldcode, int* finalkar,
+                             uint64_t* produced){
   struct elt* e;
 
-  HashArray st = HashArrayCreate(1 << maxbits, escape);
+  //if unknown code, assume KwKwK
+  //(only the code about to be added can be unknown)
+  if((e = HashArrayCodeLookup(st, code)) == 0){
+    if(code != HashArrayElts(st) || oldcode == EMPTY) return -1;
+    e = HashArrayCodeLookup(st, oldcode);
+    *produced += e->len + 1;
+    if(out) stackPush(kstack, *finalkar);
+  }
+  else{
+    *produced += e->len;
+  }
 
-  Stack kstack = stackCreate();
+  if(out){
+    //add all chars in the code to a stack
+    while(e->prefix != EMPTY){
+      stackPush(kstack, e->kar);
+      code = e->prefix;
+      e = HashArrayCodeLookup(st, code);
+    }
+
+    //save the first char of this code, and print it
+    *finalkar = e->kar;
+    putByte(out, *finalkar);
+
+    //print all the chars in the stack
+    while(!stackEmpty(kstack)){
+      putByte(out, stackPop(kstack));
+    }
+  }
+  else{
+    //when scanning, the table knows the first char without the walk
+    *finalkar = e->first;
+  }
+
+  return 0;
+}
 
-  oldcode = EMPTY;
-  while((code = newcode = getBits(nbits)) != EOF){
+// -----------------------------------------------------------------------------
+// void addCode
+// -----------------------------------------------------------------------------
+// Description:
+//   updates the string table after a code is decoded: adds the entry for the
+//   previous code followed by the code's first char, and the code's sent time
+// Parameters:
+//   HashArray st - the string table
+//   int code - the code decoded
+//   int oldcode - the previous code, EMPTY after an escape or sync
+//   int finalkar - the first char of the code's string
+//   int* justpruned - 1 if the table was pruned since the previous code, then
+//                     cleared
+//   int64_t time - the sent time for the code
+
+static inline void addCode(HashArray st, int code, int oldcode, int finalkar,
+                           int* justpruned, int64_t time){
+  //insert the new code
+  //(unless no space, or we just pruned the table, or it's a 1-char code)
+  if (oldcode != EMPTY){
+    if(HashArrayFreeSpots(st) != 0 && *justpruned == 0){
+      HashArrayInsert(st, finalkar, oldcode);
+    }
+  }
+
+  HashArrayUpdateSentTime(st, code, time);
+
+  //reset just pruned, to re-enable string table insertions
+  *justpruned = 0;
+}
+
+int decoderRun(Decoder dec){
+  int64_t window = dec->window;
+  int escape = dec->escape;
+  int nbits = dec->nbits;
+  int oldcode = dec->oldcode;
+  int finalkar = dec->finalkar;
+  int justpruned = dec->justpruned;
+  int64_t timer = dec->timer;
+  HashArray st = dec->st;
+  Stack kstack = dec->kstack;
+  uint64_t produced = dec->produced;
+  uint64_t position = dec->position;
+  BitReader in = dec->in;
+  BitWriter out = dec->out;
+  int step = dec->step;
+  int pending = dec->pending;
+  int code, newcode;
+  int status = DECODE_END;
+
+  for(;;){
+    //handle the code read by decoderRunLanes, and only that in step mode
+    if(pending != NO_CODE){
+      code = newcode = pending;
+      pending = NO_CODE;
+    }
+    else if(step){
+      status = DECODE_MORE;
+      break;
+    }
+    else{
+      position = bitsRead(in);
+      code = newcode = getBits(in, nbits);
+    }
+
+    if(code == EOF){
+      //only zero padding may be left at the end
+      if(skipPadding(in) != 0 || getBits(in, 1) != EOF){
+        status = DECODE_CORRUPT;
+      }
+      break;
+    }
 
     //handle nbits incrementing code
     if(code == INCR_NBITS){
-      nbits++;
+      if(++nbits > MAX_MAXBITS){
+        status = DECODE_CORRUPT;
+        break;
+      }
+      PROBE1(decode_nbits, nbits);
       continue;
     }
 
-    //handle escape code
+    //handle sync code, the next code starts a new string
+    if(code == SYNC){
+      status = skipPadding(in) != 0 ? DECODE_CORRUPT : DECODE_SYNC;
+      oldcode = EMPTY;
+      break;
+    }
+
+    //handle escape code (never sent unless -e is set)
     if(code == ESCAPE){
-      finalkar = getBits(CHAR_BIT);
-      putchar(finalkar);
+      if(!escape || (finalkar = getBits(in, CHAR_BIT)) == EOF){
+        status = DECODE_CORRUPT;
+        break;
+      }
+      if(out) putByte(out, finalkar);
+      produced++;
       if(HashArrayFreeSpots(st) != 0){
         HashArrayInsert(st, finalkar, EMPTY);
       }
@@ -60,60 +360,240 @@ void decode(){
       continue;
     }
 
-    //handle pruning code
+    //handle pruning code (never sent unless pruning is enabled)
     if(code == PRUNE){
+      if(window == 0){
+        status = DECODE_CORRUPT;
+        break;
+      }
       st = HashArrayPrune(st, window, escape, timer);
       nbits = bitsToRepresent(HashArrayElts(st));
       justpruned = 1;
       continue;
     }
 
-    //========== main decoding algorithm ========== 
-
-    //if unknown code, assume KwKwK
-    if((e = HashArrayCodeLookup(st, code)) == 0){
-      stackPush(kstack, finalkar);
-      e = HashArrayCodeLookup(st, oldcode);
+    if(expandCode(st, kstack, out, newcode, oldcode, &finalkar,
+                  &produced) != 0){
+      status = DECODE_CORRUPT;
+      break;
     }
+    addCode(st, newcode, oldcode, finalkar, &justpruned, timer++);
+    oldcode = newcode;
 
-    if(e == NULL){
-      fprintf(stderr, "Error: input file corrupted\n");
-      exit(EXIT_FAILURE);
-    }
+  }
 
-    //add all chars in the code to a stack
-    while(e->prefix != EMPTY){
-      stackPush(kstack, e->kar);
-      code = e->prefix;
-      e = HashArrayCodeLookup(st, code);
-    }
+  dec->nbits = nbits;
+  dec->oldcode = oldcode;
+  dec->finalkar = finalkar;
+  dec->justpruned = justpruned;
+  dec->timer = timer;
+  dec->st = st;
+  dec->produced = produced;
+  dec->position = position;
+  dec->pending = pending;
 
-    //save the first char of this code, and print it
-    finalkar = e->kar;
-    putchar(finalkar);
+  return status;
+}
 
-    //print all the chars in the stack
-    while(!stackEmpty(kstack)){
-      putchar(stackPop(kstack));
+// -----------------------------------------------------------------------------
+// int laneStep
+// -----------------------------------------------------------------------------
+// Description:
+//   takes one step of a lane. Work that would wait for memory is started in
+//   one step and finished in the next, after the other lanes have taken
+//   theirs: the table entry of a string code is fetched when the code is
+//   read, and the hash table slot of the entry added after a code is fetched
+//   when the code is decoded. Other codes are handled by decoderRun in step
+//   mode.
+// Parameters:
+//   Decoder dec - the lane
+// Return value:
+//   DECODE_MORE, or what decoderRun returns at the end of the lane's stream,
+//   at a sync code or when the stream is corrupt
+
+static inline int laneStep(Decoder dec){
+  struct elt* e;
+  int code;
+
+  if(dec->adding){
+    addCode(dec->st, dec->oldcode, dec->addprefix, dec->finalkar,
+            &dec->justpruned, dec->timer++);
+    dec->adding = 0;
+  }
+
+  if(dec->pending > INCR_NBITS){
+    if(expandCode(dec->st, dec->kstack, dec->out, dec->pending, dec->oldcode,
+                  &dec->finalkar, &dec->produced) != 0){
+      return DECODE_CORRUPT;
     }
+    dec->addprefix = dec->oldcode;
+    dec->oldcode = dec->pending;
+    dec->adding = 1;
+    if(dec->addprefix != EMPTY){
+      HashArrayPrefetch(dec->st, dec->finalkar, dec->addprefix);
+    }
+  }
+
+  dec->position = bitsRead(dec->in);
+  dec->pending = code = getBits(dec->in, dec->nbits);
+  if(code > INCR_NBITS){
+    if((e = HashArrayCodeLookup(dec->st, code)) != 0) __builtin_prefetch(e);
+    return DECODE_MORE;
+  }
 
-    //insert the new code
-    //(unless no space, or we just pruned the table, or it's a 1-char code)
-    if (oldcode != EMPTY){
-      if(HashArrayFreeSpots(st) != 0 && justpruned == 0){
-        HashArrayInsert(st, finalkar, oldcode);
+  //the table must be up to date for the other codes
+  if(dec->adding){
+    addCode(dec->st, dec->oldcode, dec->addprefix, dec->finalkar,
+            &dec->justpruned, dec->timer++);
+    dec->adding = 0;
+  }
+  return decoderRun(dec);
+}
+
+void decoderRunLanes(Decoder* lanes, int* status, int n){
+  int i, running = n;
+
+  for(i = 0; i < n; i++){
+    lanes[i]->step = 1;
+    status[i] = DECODE_MORE;
+  }
+
+  //one code from each lane in turn, each fetched while the others decode
+  while(running > 0){
+    for(i = 0; i < n; i++){
+      if(status[i] == DECODE_MORE && (status[i] = laneStep(lanes[i]))
+                                     != DECODE_MORE){
+        running--;
       }
     }
+  }
+
+  for(i = 0; i < n; i++){
+    lanes[i]->step = 0;
+  }
+}
 
-    HashArrayUpdateSentTime(st, newcode, timer++);
+void decoderProgress(Decoder dec, uint64_t* produced, uint64_t* position){
+  *produced = dec->produced;
+  *position = dec->position;
+}
 
-    oldcode = newcode;
+void decoderDestroy(Decoder dec){
+  HashArrayDestroy(dec->st);
+  stackDestroy(dec->kstack);
+  free(dec);
+}
+
+// -----------------------------------------------------------------------------
+// size_t peekSource
+// -----------------------------------------------------------------------------
+// Description
+//   a ByteSource which supplies the bytes of a struct peeksource
+// Parameters:
+//   void* ctx - a pointer to the struct peeksource
+//   unsigned char* buf - the buffer to fill
+//   size_t n - the size of buf
+// Return value:
+//   the number of bytes supplied, 0 at the end of the input
+
+static size_t peekSource(void* ctx, unsigned char* buf, size_t n){
+  struct peeksource* ps = ctx;
+
+  if(ps->pos < ps->len){
+    if(n > ps->len - ps->pos) n = ps->len - ps->pos;
+    memcpy(buf, ps->head + ps->pos, n);
+    ps->pos += n;
+    return n;
+  }
+
+  return fdSource(&ps->fd, buf, n);
+}
+
+void decode(Options* opt){
+  struct peeksource ps = {.len = 0, .pos = 0, .fd = fileno(stdin)};
+  BitReader in;
+  BitWriter out;
+  Options streamopt = {.maxbits = 0};
+  uint64_t produced, position;
+  Decoder dec;
+  int status;
+  size_t got;
 
-    //reset just pruned, to re-enable string table insertions
-    if(justpruned == 1) justpruned = 0;
+  //containers start with "LZW" and a letter, which can't begin a stream
+  while(ps.len < sizeof(ps.head)
+        && (got = fdSource(&ps.fd, ps.head + ps.len,
+                           sizeof(ps.head) - ps.len)) > 0){
+    ps.len += got;
+  }
+  if(ps.len == sizeof(ps.head) && !memcmp(ps.head, ARCHIVE_MAGIC, 4)){
+    archiveExtract(opt, ps.fd);
+    return;
+  }
+  if(opt->list || opt->npaths){
+    fprintf(stderr, "Error: --list and member names can only be used with "
+            "archives.\n");
+    exit(EXIT_FAILURE);
+  }
+  if(ps.len == sizeof(ps.head) && !memcmp(ps.head, FIELDS_MAGIC, 4)){
+    fieldsDecode(opt, stdin);
+    return;
+  }
+  if(ps.len == sizeof(ps.head) && !memcmp(ps.head, FILTER_MAGIC, 4)){
+    filterDecode(opt, stdin);
+    return;
+  }
+  if(ps.len == sizeof(ps.head) && !memcmp(ps.head, BLOCKS_MAGIC, 4)){
+    blocksDecode(opt, stdin);
+    return;
+  }
+  if(ps.len == sizeof(ps.head) && !memcmp(ps.head, DEDUP_MAGIC, 4)){
+    dedupDecode(opt, stdin);
+    return;
+  }
+  if(ps.len == sizeof(ps.head) && !memcmp(ps.head, LANES_MAGIC, 4)){
+    lanesDecode(opt, stdin);
+    return;
+  }
+
+  //read whatever has arrived, so flushed data is output without waiting
+  in = bitReaderCreate(peekSource, &ps);
+  out = opt->scan ? 0 : bitWriterCreate(fileSink, stdout);
+
+  if(decoderReadHeader(in, &streamopt) != 0){
+    fprintf(stderr,"Error: input file corrupted at byte 0\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(opt->maxmemory && memoryFootprint(&streamopt) > opt->maxmemory){
+    fprintf(stderr, "Error: stream needs %" PRIu64 " bytes of memory, "
+            "more than --max-memory allows.\n", memoryFootprint(&streamopt));
+    exit(EXIT_FAILURE);
+  }
+
+  dec = decoderCreate(&streamopt, in, out);
+
+  //output everything decoded so far at every sync point
+  while((status = decoderRun(dec)) == DECODE_SYNC){
+    if(out){
+      sendRemainingBits(out);
+      fflush(stdout);
+    }
+  }
+  if(out) sendRemainingBits(out);
+
+  decoderProgress(dec, &produced, &position);
+  if(status == DECODE_CORRUPT){
+    fprintf(stderr, "Error: input file corrupted at byte %" PRIu64
+            " (bit %" PRIu64 "), after %" PRIu64 " bytes of output\n",
+            position / CHAR_BIT, position, produced);
+    exit(EXIT_FAILURE);
+  }
 
+  if(opt->scan){
+    printf("%" PRIu64 "\n", produced);
   }
 
-  HashArrayDestroy(st);
-  stackDestroy(kstack);
-}
\ No newline at end of file
+  decoderDestroy(dec);
+  if(out) bitWriterDestroy(out);
+  bitReaderDestroy(in);
+}
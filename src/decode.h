@@ -5,11 +5,138 @@ contains function declaration for the LZW decode
 by Geoffrey Litt
 */
 
+                          //the values returned by decoderRun when:
+#define DECODE_END (0)    //the stream ended
+#define DECODE_SYNC (1)   //a sync code was read
+#define DECODE_CORRUPT (-1) //the stream is corrupt
+
+typedef struct decoder *Decoder;
+
+// -----------------------------------------------------------------------------
+// int decoderReadHeader
+// -----------------------------------------------------------------------------
+// Description:
+//   reads the header at the beginning of a compressed stream
+// Parameters:
+//   BitReader in - the compressed stream
+//   Options* opt - a pointer to an options struct whose maxbits, prune and
+//                  escape fields are set from the header
+// Return value:
+//   0 if the header is valid, -1 if it is corrupt
+
+int decoderReadHeader(BitReader in, Options* opt);
+
+// -----------------------------------------------------------------------------
+// Decoder decoderCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   creates a decoder for a stream whose header has already been read
+// Parameters:
+//   Options* opt - a pointer to an options struct holding the header values
+//   BitReader in - the compressed stream, positioned after the header
+//   BitWriter out - where the decompressed bytes are written, or a null
+//                   pointer to only check the stream and count its length.
+//                   That rebuilds the string table as usual, but takes each
+//                   code's length from the table instead of writing out its
+//                   string, which is much faster.
+// Return value:
+//   a new Decoder
+
+Decoder decoderCreate(Options* opt, BitReader in, BitWriter out);
+
+// -----------------------------------------------------------------------------
+// Decoder decoderTryCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   creates a decoder like decoderCreate, but returns instead of exiting the
+//   program if its string table can't be allocated
+// Parameters:
+//   Options* opt - a pointer to an options struct holding the header values
+//   BitReader in - the compressed stream, after its header
+//   BitWriter out - where the decompressed bytes are written, null to scan
+// Return value:
+//   a new Decoder, or a null pointer if there isn't enough memory
+
+Decoder decoderTryCreate(Options* opt, BitReader in, BitWriter out);
+
+// -----------------------------------------------------------------------------
+// void decoderReset
+// -----------------------------------------------------------------------------
+// Description:
+//   starts decoding a new stream on an existing Decoder, as if it had just
+//   been created with decoderCreate, but reusing its string table memory when
+//   maxbits is unchanged
+// Parameters:
+//   Decoder dec - the Decoder to reset
+//   Options* opt - a pointer to an options struct holding the header values
+//                  of the new stream, whose header has already been read
+
+void decoderReset(Decoder dec, Options* opt);
+
+// -----------------------------------------------------------------------------
+// int decoderRun
+// -----------------------------------------------------------------------------
+// Description:
+//   decompresses codes until the stream ends or a sync code is read. All the
+//   bytes for the codes before a sync code have been written to the
+//   BitWriter (but not necessarily handed to its sink) when it returns.
+// Parameters:
+//   Decoder dec - the Decoder to run
+// Return value:
+//   DECODE_END, DECODE_SYNC or DECODE_CORRUPT
+
+int decoderRun(Decoder dec);
+
+// -----------------------------------------------------------------------------
+// void decoderRunLanes
+// -----------------------------------------------------------------------------
+// Description:
+//   runs several Decoders of independent streams, as decoderRun would run
+//   each of them, but taking one code from each in turn. The string table
+//   entry for a lane's next code is prefetched before the other lanes take
+//   their turns, so the cache misses of the lanes overlap instead of each
+//   waiting for the one before, on a single thread.
+// Parameters:
+//   Decoder* lanes - the Decoders to run
+//   int* status - set to what decoderRun would have returned for each lane
+//   int n - the number of lanes
+
+void decoderRunLanes(Decoder* lanes, int* status, int n);
+
+// -----------------------------------------------------------------------------
+// void decoderProgress
+// -----------------------------------------------------------------------------
+// Description:
+//   reports how far a Decoder has got
+// Parameters:
+//   Decoder dec - the Decoder to examine
+//   uint64_t* produced - set to the number of bytes decoded so far
+//   uint64_t* position - set to the bit offset in the compressed stream of the
+//                        last code read, which is where the stream is corrupt
+//                        after decoderRun returns DECODE_CORRUPT
+
+void decoderProgress(Decoder dec, uint64_t* produced, uint64_t* position);
+
+// -----------------------------------------------------------------------------
+// void decoderDestroy
+// -----------------------------------------------------------------------------
+// Description:
+//   frees a Decoder and its string table. The BitReader and BitWriter are not
+//   freed.
+// Parameters:
+//   Decoder dec - the Decoder to destroy
+
+void decoderDestroy(Decoder dec);
+
 // -----------------------------------------------------------------------------
 // void decode
 // -----------------------------------------------------------------------------
 // Description:
 //  decompresses a compressed bytestream from stdin using the LZW algorithm,
 //  outputs the decompressed bytestream to stdout
+// Parameters:
+//   Options* opt - a pointer to an options struct. Streams needing more than
+//                  maxmemory are refused, and if scan is set the stream is
+//                  only checked, and its decompressed length printed.
 
-void decode();
\ No newline at end of file
+void decode(Options* opt);
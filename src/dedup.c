@@ -0,0 +1,531 @@
+/*
+dedup.c
+contains implementation code for dedup mode
+*/
+
+#define _GNU_SOURCE
+#include "globals.h"
+#include "bitio.h"
+#include "encode.h"
+#include "decode.h"
+#include "budget.h"
+#include "dedup.h"
+#include <unistd.h>
+
+#define DEDUP_MINCHUNK (8 << 10)     //the shortest chunk, except the last
+#define DEDUP_MAXCHUNK (256 << 10)   //the longest chunk
+#define DEDUP_MASK ((((uint64_t)1 << 15) - 1) << 49)  //hash bits clear at a
+                                                      //cut, 32K on average
+#define DEDUP_BUFSIZE (4 * DEDUP_MAXCHUNK)  //input bytes buffered for chunking
+#define DEDUP_NEW (1)                //the record types
+#define DEDUP_REPEAT (2)
+#define DIGEST_SIZE (32)             //bytes in a SHA-256 digest
+
+// -----------------------------------------------------------------------------
+// void sha256
+// -----------------------------------------------------------------------------
+// Description:
+//   computes the SHA-256 digest of a buffer
+// Parameters:
+//   const unsigned char* data - the buffer
+//   size_t n - the number of bytes in data
+//   unsigned char* digest - set to the DIGEST_SIZE bytes of the digest
+
+static const uint32_t sha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256Block(uint32_t* h, const unsigned char* p){
+  uint32_t w[64], s[8], t1, t2;
+  int i;
+
+  for(i = 0; i < 16; i++){
+    w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16
+           | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+  }
+  for(i = 16; i < 64; i++){
+    w[i] = w[i - 16] + w[i - 7]
+           + (ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3))
+           + (ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+  }
+
+  memcpy(s, h, sizeof(s));
+  for(i = 0; i < 64; i++){
+    t1 = s[7] + (ROTR(s[4], 6) ^ ROTR(s[4], 11) ^ ROTR(s[4], 25))
+         + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256K[i] + w[i];
+    t2 = (ROTR(s[0], 2) ^ ROTR(s[0], 13) ^ ROTR(s[0], 22))
+         + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    memmove(s + 1, s, 7 * sizeof(s[0]));
+    s[4] += t1;
+    s[0] = t1 + t2;
+  }
+  for(i = 0; i < 8; i++){
+    h[i] += s[i];
+  }
+}
+
+static void sha256(const unsigned char* data, size_t n, unsigned char* digest){
+  uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  unsigned char last[128];
+  uint64_t bits = (uint64_t)n * CHAR_BIT;
+  size_t i, rest, blocks;
+
+  for(i = 0; i + 64 <= n; i += 64){
+    sha256Block(h, data + i);
+  }
+
+  //pad with a 1 bit, zeros and the length in bits
+  rest = n - i;
+  blocks = rest + 9 > 64 ? 2 : 1;
+  memset(last, 0, sizeof(last));
+  memcpy(last, data + i, rest);
+  last[rest] = 0x80;
+  for(i = 0; i < 8; i++){
+    last[blocks * 64 - 1 - i] = bits >> (8 * i);
+  }
+  for(i = 0; i < blocks; i++){
+    sha256Block(h, last + 64 * i);
+  }
+
+  for(i = 0; i < 8; i++){
+    digest[4 * i] = h[i] >> 24;
+    digest[4 * i + 1] = h[i] >> 16;
+    digest[4 * i + 2] = h[i] >> 8;
+    digest[4 * i + 3] = h[i];
+  }
+}
+
+// -----------------------------------------------------------------------------
+// struct fingerprint
+// -----------------------------------------------------------------------------
+// Description:
+//   an entry of the index of new chunks
+// Fields:
+//   unsigned char digest[] - the SHA-256 digest of the chunk
+//   uint64_t chunk - the number of the new chunk plus 1, 0 if the entry is
+//                    free
+
+struct fingerprint{
+  unsigned char digest[DIGEST_SIZE];
+  uint64_t chunk;
+};
+
+// -----------------------------------------------------------------------------
+// struct dedup
+// -----------------------------------------------------------------------------
+// Description:
+//   the state of the encoder in dedup mode
+// Fields:
+//   Encoder enc - compresses the new chunks
+//   BitWriter out - writes the compressed bytes to packed
+//   unsigned char* packed - the compressed bytes of the current chunk
+//   size_t len - the number of bytes in packed
+//   size_t cap - the number of bytes allocated for packed
+//   struct fingerprint* index - a hash table of the new chunks, by digest
+//   uint64_t size - the number of entries in index, a power of 2
+//   uint64_t unique - the number of new chunks
+//   uint64_t chunks - the number of chunks
+//   uint64_t saved - the number of bytes in repeated chunks
+//   uint64_t gear[] - the random value each byte adds to the rolling hash
+
+struct dedup{
+  Encoder enc;
+  BitWriter out;
+  unsigned char* packed;
+  size_t len;
+  size_t cap;
+  struct fingerprint* index;
+  uint64_t size;
+  uint64_t unique;
+  uint64_t chunks;
+  uint64_t saved;
+  uint64_t gear[1 << CHAR_BIT];
+};
+
+static size_t packedSink(void* ctx, const unsigned char* buf, size_t n){
+  struct dedup* d = ctx;
+
+  if(d->len + n > d->cap){
+    d->cap = d->len + n > 2 * d->cap ? d->len + n : 2 * d->cap;
+    d->packed = realloc(d->packed, d->cap);
+  }
+  memcpy(d->packed + d->len, buf, n);
+  d->len += n;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// size_t cutPoint
+// -----------------------------------------------------------------------------
+// Description:
+//   finds where the next chunk ends, where the rolling hash of the last 64
+//   bytes has its DEDUP_MASK bits clear
+// Parameters:
+//   struct dedup* d - the dedup state, holding the hash's table
+//   const unsigned char* buf - the input from the start of the chunk
+//   size_t n - the number of bytes in buf, at least DEDUP_MAXCHUNK unless
+//              the input ends within it
+// Return value:
+//   the length of the chunk
+
+static size_t cutPoint(struct dedup* d, const unsigned char* buf, size_t n){
+  uint64_t hash = 0;
+  size_t i;
+
+  if(n > DEDUP_MAXCHUNK) n = DEDUP_MAXCHUNK;
+  if(n <= DEDUP_MINCHUNK) return n;
+
+  //bytes shift out of the hash after 64 more, so start just before the
+  //shortest cut
+  for(i = DEDUP_MINCHUNK - 64; i < n; i++){
+    hash = (hash << 1) + d->gear[buf[i]];
+    if(i >= DEDUP_MINCHUNK && (hash & DEDUP_MASK) == 0) return i + 1;
+  }
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// struct fingerprint* findChunk
+// -----------------------------------------------------------------------------
+// Description:
+//   looks up a digest in the index of new chunks
+// Parameters:
+//   struct dedup* d - the dedup state
+//   const unsigned char* digest - the digest
+// Return value:
+//   the entry holding the digest, or the free entry where it would go
+
+static struct fingerprint* findChunk(struct dedup* d,
+                                     const unsigned char* digest){
+  uint64_t i;
+
+  memcpy(&i, digest, sizeof(i));
+  for(i &= d->size - 1; d->index[i].chunk != 0; i = (i + 1) & (d->size - 1)){
+    if(!memcmp(d->index[i].digest, digest, DIGEST_SIZE)) break;
+  }
+
+  return &d->index[i];
+}
+
+// -----------------------------------------------------------------------------
+// void addChunk
+// -----------------------------------------------------------------------------
+// Description:
+//   writes the record of a chunk, compressing it if it is new
+// Parameters:
+//   struct dedup* d - the dedup state
+//   const unsigned char* buf - the chunk
+//   size_t n - the number of bytes in the chunk
+
+static void addChunk(struct dedup* d, const unsigned char* buf, size_t n){
+  unsigned char digest[DIGEST_SIZE];
+  struct fingerprint *f, *old;
+  uint64_t i, oldsize;
+
+  sha256(buf, n, digest);
+  f = findChunk(d, digest);
+  d->chunks++;
+
+  if(f->chunk != 0){
+    putchar(DEDUP_REPEAT);
+    writeNumber(stdout, f->chunk - 1, 8);
+    d->saved += n;
+    return;
+  }
+
+  memcpy(f->digest, digest, DIGEST_SIZE);
+  f->chunk = ++d->unique;
+
+  //keep the index at most half full
+  if(2 * d->unique > d->size){
+    old = d->index;
+    oldsize = d->size;
+    d->size *= 2;
+    d->index = calloc(d->size, sizeof(*d->index));
+    for(i = 0; i < oldsize; i++){
+      if(old[i].chunk != 0) *findChunk(d, old[i].digest) = old[i];
+    }
+    free(old);
+  }
+
+  encoderWrite(d->enc, buf, n);
+  encoderFlush(d->enc);
+  putchar(DEDUP_NEW);
+  writeNumber(stdout, n, 4);
+  writeNumber(stdout, d->len, 4);
+  fwrite(d->packed, 1, d->len, stdout);
+  d->len = 0;
+}
+
+void dedupEncode(Options* opt, ByteSource in, void* ctx){
+  struct dedup* d = calloc(1, sizeof(*d));
+  unsigned char* buf = malloc(DEDUP_BUFSIZE);
+  uint64_t seed = 88172645463325252ull;
+  size_t len = 0, pos, got, n;
+  EncoderStats stats;
+  int eof = 0, i;
+
+  //the same table every time, so the same data is cut in the same places
+  for(i = 0; i < (1 << CHAR_BIT); i++){
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    d->gear[i] = seed;
+  }
+  d->size = 1024;
+  d->index = calloc(d->size, sizeof(*d->index));
+  d->out = bitWriterCreate(packedSink, d);
+  d->enc = encoderCreate(opt, d->out);
+
+  fputs(DEDUP_MAGIC, stdout);
+  putchar(DEDUP_VERSION);
+
+  for(;;){
+    while(!eof && len < DEDUP_BUFSIZE){
+      if((got = in(ctx, buf + len, DEDUP_BUFSIZE - len)) == 0) eof = 1;
+      len += got;
+    }
+    if(len == 0) break;
+
+    //only cut where a whole chunk could fit, unless the input has ended
+    for(pos = 0; len - pos >= DEDUP_MAXCHUNK || (eof && pos < len); pos += n){
+      n = cutPoint(d, buf + pos, len - pos);
+      addChunk(d, buf + pos, n);
+    }
+    memmove(buf, buf + pos, len - pos);
+    len -= pos;
+  }
+  putchar(0);
+
+  if(fflush(stdout) != 0){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(opt->stats){
+    fprintf(stderr, "%" PRIu64 " chunks, %" PRIu64 " repeated (%" PRIu64
+            " bytes)\n", d->chunks, d->chunks - d->unique, d->saved);
+    encoderStats(d->enc, &stats);
+    printEncoderStats(stderr, &stats);
+  }
+
+  encoderDestroy(d->enc);
+  bitWriterDestroy(d->out);
+  free(d->packed);
+  free(d->index);
+  free(d);
+  free(buf);
+}
+
+// -----------------------------------------------------------------------------
+// struct undedup
+// -----------------------------------------------------------------------------
+// Description:
+//   the state of the decoder in dedup mode
+// Fields:
+//   unsigned char* packed - the compressed bytes of the current chunk
+//   size_t len - the number of bytes in packed
+//   size_t cap - the number of bytes allocated for packed
+//   size_t pos - the number of bytes of packed already read
+//   uint64_t fed - the number of compressed bytes read so far
+//   FILE* store - a temporary file holding the new chunks, unless scanning
+//   uint64_t stored - the number of bytes in store
+//   uint64_t* offsets - where each new chunk starts in store
+//   uint64_t* lengths - the length of each new chunk
+//   uint64_t unique - the number of new chunks
+//   uint64_t chunkcap - the number of new chunks offsets and lengths can hold
+
+struct undedup{
+  unsigned char* packed;
+  size_t len;
+  size_t cap;
+  size_t pos;
+  uint64_t fed;
+  FILE* store;
+  uint64_t stored;
+  uint64_t* offsets;
+  uint64_t* lengths;
+  uint64_t unique;
+  uint64_t chunkcap;
+};
+
+static size_t packedSource(void* ctx, unsigned char* buf, size_t n){
+  struct undedup* u = ctx;
+
+  if(n > u->len - u->pos) n = u->len - u->pos;
+  memcpy(buf, u->packed + u->pos, n);
+  u->pos += n;
+  u->fed += n;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// size_t chunkSink
+// -----------------------------------------------------------------------------
+// Description:
+//   a ByteSink which writes decompressed bytes both to stdout and to the
+//   store, ctx is the struct undedup*
+
+static size_t chunkSink(void* ctx, const unsigned char* buf, size_t n){
+  struct undedup* u = ctx;
+
+  if(fwrite(buf, 1, n, stdout) != n || fwrite(buf, 1, n, u->store) != n){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+  u->stored += n;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void copyChunk
+// -----------------------------------------------------------------------------
+// Description:
+//   writes a new chunk again, from the store
+// Parameters:
+//   struct undedup* u - the dedup state
+//   uint64_t chunk - the number of the chunk
+
+static void copyChunk(struct undedup* u, uint64_t chunk){
+  unsigned char buf[1 << 16];
+  uint64_t offset = u->offsets[chunk], left = u->lengths[chunk];
+  ssize_t n;
+
+  if(fflush(u->store) != 0){
+    fprintf(stderr, "Error: could not write the temporary file\n");
+    exit(EXIT_FAILURE);
+  }
+  while(left > 0){
+    n = pread(fileno(u->store), buf, left < sizeof(buf) ? left : sizeof(buf),
+              offset);
+    if(n <= 0 || fwrite(buf, 1, n, stdout) != (size_t)n){
+      fprintf(stderr, "Error: could not copy a repeated chunk\n");
+      exit(EXIT_FAILURE);
+    }
+    offset += n;
+    left -= n;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// void corrupt
+// -----------------------------------------------------------------------------
+// Description:
+//   reports a corrupt dedup stream and exits
+// Parameters:
+//   uint64_t chunk - the number of the chunk where the problem was found
+
+static void corrupt(uint64_t chunk){
+  fprintf(stderr, "Error: input file corrupted in chunk %" PRIu64 "\n", chunk);
+  exit(EXIT_FAILURE);
+}
+
+void dedupDecode(Options* opt, FILE* in){
+  struct undedup u = {.packed = 0, .len = 0, .cap = 0, .pos = 0, .fed = 0,
+                      .store = 0, .stored = 0, .offsets = 0, .lengths = 0,
+                      .unique = 0, .chunkcap = 0};
+  Options streamopt = {.maxbits = 0};
+  uint64_t chunk, len, size, produced, position, before = 0, total = 0;
+  BitReader br = bitReaderCreate(packedSource, &u);
+  BitWriter out = 0;
+  Decoder dec = 0;
+  int type;
+
+  if(getc(in) != DEDUP_VERSION){
+    fprintf(stderr, "Error: input file corrupted at byte 4\n");
+    exit(EXIT_FAILURE);
+  }
+  if(!opt->scan){
+    if((u.store = tmpfile()) == 0){
+      fprintf(stderr, "Error: could not create a temporary file\n");
+      exit(EXIT_FAILURE);
+    }
+    out = bitWriterCreate(chunkSink, &u);
+  }
+
+  for(chunk = 0; (type = getc(in)) != 0; chunk++){
+    if(type == DEDUP_REPEAT){
+      if(readNumber(in, &len, 8) != 0 || len >= u.unique) corrupt(chunk);
+      if(!opt->scan) copyChunk(&u, len);
+      total += u.lengths[len];
+      continue;
+    }
+    if(type != DEDUP_NEW || readNumber(in, &size, 4) != 0
+       || readNumber(in, &len, 4) != 0){
+      corrupt(chunk);
+    }
+
+    if(len > u.cap){
+      u.cap = len;
+      u.packed = realloc(u.packed, u.cap);
+    }
+    if(fread(u.packed, 1, len, in) != len) corrupt(chunk);
+    u.len = len;
+    u.pos = 0;
+
+    //the first new chunk starts with the stream header
+    if(!dec){
+      if(decoderReadHeader(br, &streamopt) != 0) corrupt(chunk);
+      if(opt->maxmemory && memoryFootprint(&streamopt) > opt->maxmemory){
+        fprintf(stderr, "Error: stream needs %" PRIu64 " bytes of memory, "
+                "more than --max-memory allows.\n",
+                memoryFootprint(&streamopt));
+        exit(EXIT_FAILURE);
+      }
+      dec = decoderCreate(&streamopt, br, out);
+    }
+
+    //each new chunk ends at a sync point, where its bytes have all been read
+    if(decoderRun(dec) != DECODE_SYNC || bitsRead(br) != u.fed * CHAR_BIT){
+      corrupt(chunk);
+    }
+    decoderProgress(dec, &produced, &position);
+    if(produced - before != size) corrupt(chunk);
+    if(out) sendRemainingBits(out);
+
+    if(u.unique == u.chunkcap){
+      u.chunkcap = u.chunkcap ? 2 * u.chunkcap : 1024;
+      u.offsets = realloc(u.offsets, u.chunkcap * sizeof(*u.offsets));
+      u.lengths = realloc(u.lengths, u.chunkcap * sizeof(*u.lengths));
+    }
+    u.offsets[u.unique] = u.stored - size;
+    u.lengths[u.unique++] = size;
+    before = produced;
+    total += size;
+  }
+
+  if(getc(in) != EOF) corrupt(chunk);
+
+  if(fflush(stdout) != 0){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+  if(opt->scan){
+    printf("%" PRIu64 "\n", total);
+  }
+
+  if(dec) decoderDestroy(dec);
+  if(out) bitWriterDestroy(out);
+  if(u.store) fclose(u.store);
+  bitReaderDestroy(br);
+  free(u.packed);
+  free(u.offsets);
+  free(u.lengths);
+}
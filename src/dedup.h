@@ -0,0 +1,50 @@
+/*
+dedup.h
+contains declarations for dedup mode, which finds large repeated regions of
+the input, however far apart, and stores each of them only once
+
+The input is split into chunks at positions chosen by its content (where a
+rolling hash of the last bytes has its top bits clear), so that the same
+data gives the same chunks wherever it is. Each chunk is identified by its
+SHA-256 digest. The first copy of a chunk is compressed, and later copies are
+replaced by a reference to it.
+
+A dedup stream starts with the magic "LZWD" and a version byte, followed by a
+record for each chunk and a 0 byte at the end. A new chunk is a 1 byte, its
+length (4 bytes, little endian), the length of its compressed bytes (4
+bytes) and the bytes, which continue one compressed stream over all the new
+chunks and end at a sync point. A repeated chunk is a 2 byte and the number
+of the new chunk it repeats (8 bytes, counting from 0).
+*/
+
+#define DEDUP_MAGIC "LZWD"        //the first bytes of a dedup stream
+#define DEDUP_VERSION (1)         //the format version after the magic
+
+// -----------------------------------------------------------------------------
+// void dedupEncode
+// -----------------------------------------------------------------------------
+// Description:
+//   splits the input into chunks, compresses the first copy of each, and
+//   writes the dedup stream to stdout
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the encoding
+//                  parameters
+//   ByteSource in - the function supplying the bytes to compress
+//   void* ctx - the context pointer for in
+
+void dedupEncode(Options* opt, ByteSource in, void* ctx);
+
+// -----------------------------------------------------------------------------
+// void dedupDecode
+// -----------------------------------------------------------------------------
+// Description:
+//   decompresses a dedup stream whose magic has already been read, and writes
+//   the result to stdout. The new chunks are also kept in a temporary file,
+//   where repeated chunks are copied from.
+// Parameters:
+//   Options* opt - a pointer to an options struct. Streams needing more than
+//                  maxmemory are refused, and if scan is set the stream is
+//                  only checked, and its decompressed length printed.
+//   FILE* in - the dedup stream
+
+void dedupDecode(Options* opt, FILE* in);
@@ -5,111 +5,957 @@ contains the implementation of the LZW encoder
 by Geoffrey Litt
 */
 
+#define _GNU_SOURCE
 #include "globals.h"
+#include "bitio.h"
 #include "encode.h"
 #include "hasharray.h"
-#include "bitio.h"
+#include "verify.h"
+#include "probes.h"
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ENCODE_BUFSIZE (1 << 16)  //bytes read from the input at a time
+#define CHECKPOINT_MAGIC "LZWK"   //first bytes of a checkpoint file
+#define CHECKPOINT_VERSION (1)
+#define LONGMATCH_MIN (16)        //shortest extension worth comparing for
+#define BEST_CHOICES (16)         //shorter codes --best considers at each step
+#define BEST_MARGIN (4)           //how much further a shorter code has to let
+                                  //the next one reach, while the table grows
+
+// -----------------------------------------------------------------------------
+// struct longmatch
+// -----------------------------------------------------------------------------
+// Description:
+//   the state of the long match fast path. It remembers where in the input
+//   each code's string last occurred, and for each one-char code a long code
+//   starting with it that was made recently. When a match starts with that
+//   char, the rest of the long code's string is compared with the input many
+//   bytes at a time, and the encoder jumps straight to the longest part of it
+//   that matches. Every prefix of a code is in the table, so greedy matching
+//   would get to the same code one char at a time, and the output is the same.
+// Fields:
+//   int64_t* lastpos - for each code, the input position where the string
+//                      it was made from started
+//   int* ext - for each one-char code, a long code starting with it, or 0
+//   unsigned char* history - the last LONGMATCH_HISTORY bytes of input
+//   uint64_t histend - the number of bytes of input so far
+//   int64_t start - the input position where the current match started
+//   int root - the one-char code the current match started with
+//   int size - the number of codes lastpos and ext have room for
+
+struct longmatch{
+  int64_t* lastpos;
+  int* ext;
+  unsigned char* history;
+  uint64_t histend;
+  int64_t start;
+  int root;
+  int size;
+};
+
+// -----------------------------------------------------------------------------
+// struct encoder
+// -----------------------------------------------------------------------------
+// Description:
+//   the state of the encoding loop, kept between calls to encoderWrite
+// Fields:
+//   int maxbits, int64_t window, int escape - the encoding parameters
+//   int nbits - the number of bits currently used to send codes
+//   int code - the code of the string matched so far, EMPTY if none
+//   int64_t timer - the number of codes sent so far, plus one
+//   HashArray st - the string table
+//   BitWriter out - where the compressed stream is written
+//   uint64_t outstart - bytesWritten(out) when the stream started
+//   EncoderStats stats - the counters reported by encoderStats
+//   struct longmatch* lm - the long match state, null if it is not used
+//   unsigned char* ahead - for --best, the input not parsed yet, null if the
+//                          input is parsed greedily
+//   size_t aheadlen - the number of bytes in ahead
+//   size_t aheadcap - the number of bytes allocated for ahead
+
+struct encoder{
+  int maxbits;
+  int64_t window;
+  int escape;
+  int nbits;
+  int code;
+  int64_t timer;
+  HashArray st;
+  BitWriter out;
+  uint64_t outstart;
+  EncoderStats stats;
+  struct longmatch* lm;
+  unsigned char* ahead;
+  size_t aheadlen;
+  size_t aheadcap;
+};
+
+// -----------------------------------------------------------------------------
+// void longMatchSetup
+// -----------------------------------------------------------------------------
+// Description:
+//   creates, resizes, clears or frees an Encoder's long match state
+// Parameters:
+//   Encoder enc - the Encoder
+//   int use - 1 if the long match fast path is to be used
+
+static void longMatchSetup(Encoder enc, int use){
+  struct longmatch* lm = enc->lm;
+  int size = 1 << enc->maxbits;
+
+  if(!use){
+    if(lm){
+      free(lm->lastpos);
+      free(lm->ext);
+      free(lm->history);
+      free(lm);
+      enc->lm = 0;
+    }
+    return;
+  }
+
+  if(!lm){
+    lm = enc->lm = malloc(sizeof(*lm));
+    lm->history = malloc(LONGMATCH_HISTORY);
+    lm->histend = 0;
+    lm->lastpos = 0;
+    lm->ext = 0;
+    lm->size = 0;
+  }
+  if(lm->size != size){
+    lm->lastpos = realloc(lm->lastpos, size * sizeof(*lm->lastpos));
+    lm->ext = realloc(lm->ext, size * sizeof(*lm->ext));
+    lm->size = size;
+  }
+  memset(lm->ext, 0, size * sizeof(*lm->ext));
+}
+
+// -----------------------------------------------------------------------------
+// size_t matchLength
+// -----------------------------------------------------------------------------
+// Description:
+//   counts how many bytes at the start of two buffers are equal, comparing
+//   a word at a time
+// Parameters:
+//   const unsigned char* a, b - the buffers
+//   size_t max - the most bytes to compare
+// Return value:
+//   the number of equal bytes
+
+static size_t matchLength(const unsigned char* a, const unsigned char* b,
+                          size_t max){
+  uint64_t x, y;
+  size_t len = 0;
+
+  while(len + sizeof(x) <= max){
+    memcpy(&x, a + len, sizeof(x));
+    memcpy(&y, b + len, sizeof(y));
+    if(x != y) break;
+    len += sizeof(x);
+  }
+  while(len < max && a[len] == b[len]){
+    len++;
+  }
+
+  return len;
+}
+
+// -----------------------------------------------------------------------------
+// int longMatch
+// -----------------------------------------------------------------------------
+// Description:
+//   tries the long match fast path for a match which has just started
+// Parameters:
+//   struct longmatch* lm - the long match state
+//   HashArray st - the string table
+//   int code - the one-char code the match started with
+//   const unsigned char* buf - the input being encoded
+//   size_t* i - the index in buf after the match, moved past the bytes
+//               skipped
+//   size_t n - the number of bytes in buf
+// Return value:
+//   the code of the longest match found, code itself if none is longer
+
+static int longMatch(struct longmatch* lm, HashArray st, int code,
+                     const unsigned char* buf, size_t* i, size_t n){
+  struct elt *c, *e;
+  size_t want, m, p, first;
+  int d = lm->ext[code];
+
+  if(d == 0 || (uint64_t)lm->lastpos[d] + LONGMATCH_HISTORY < lm->histend){
+    return code;
+  }
+
+  c = HashArrayCodeLookup(st, code);
+  e = HashArrayCodeLookup(st, d);
+  if((want = e->len - c->len) > n - *i) want = n - *i;
+  if(want < LONGMATCH_MIN) return code;
+
+  //compare the rest of the long code's string, which may wrap around the
+  //end of the history, with the input
+  p = (lm->lastpos[d] + c->len) % LONGMATCH_HISTORY;
+  first = LONGMATCH_HISTORY - p < want ? LONGMATCH_HISTORY - p : want;
+  m = matchLength(lm->history + p, buf + *i, first);
+  if(m == first && want > first){
+    m += matchLength(lm->history, buf + *i + first, want - first);
+  }
+
+  //on a partial match, use the prefix of the long code that did match,
+  //unless it is so far up that walking there costs more than it saves
+  if(m < LONGMATCH_MIN || e->len - c->len - m > m) return code;
+  while(e->len > c->len + (int)m){
+    e = HashArrayCodeLookup(st, e->prefix);
+  }
+
+  *i += m;
+  return e->code;
+}
+
+// -----------------------------------------------------------------------------
+// void longMatchRemember
+// -----------------------------------------------------------------------------
+// Description:
+//   records that a code's string started where the current match started,
+//   and makes it the long code tried for the match's first char
+// Parameters:
+//   struct longmatch* lm - the long match state
+//   int code - the code, which must start with the current match
+
+static void longMatchRemember(struct longmatch* lm, int code){
+  lm->lastpos[code] = lm->start;
+  if(code != lm->root) lm->ext[lm->root] = code;
+}
+
+// -----------------------------------------------------------------------------
+// void longMatchInput
+// -----------------------------------------------------------------------------
+// Description:
+//   adds input to the history, which must have room for all of it
+// Parameters:
+//   struct longmatch* lm - the long match state
+//   const unsigned char* buf - the input
+//   size_t n - the number of bytes in buf, at most LONGMATCH_HISTORY
+
+static void longMatchInput(struct longmatch* lm, const unsigned char* buf,
+                           size_t n){
+  size_t p = lm->histend % LONGMATCH_HISTORY;
+  size_t first = LONGMATCH_HISTORY - p < n ? LONGMATCH_HISTORY - p : n;
+
+  memcpy(lm->history + p, buf, first);
+  memcpy(lm->history, buf + first, n - first);
+  lm->histend += n;
+}
+
+// -----------------------------------------------------------------------------
+// void bestSetup
+// -----------------------------------------------------------------------------
+// Description:
+//   creates, empties or frees an Encoder's buffer of input for --best
+// Parameters:
+//   Encoder enc - the Encoder
+//   int use - 1 if the input is to be parsed with --best
+
+static void bestSetup(Encoder enc, int use){
+  if(!use){
+    free(enc->ahead);
+    enc->ahead = 0;
+    enc->aheadcap = 0;
+  }
+  else if(!enc->ahead){
+    enc->aheadcap = ENCODE_BUFSIZE;
+    enc->ahead = malloc(enc->aheadcap);
+  }
+  enc->aheadlen = 0;
+}
+
+// -----------------------------------------------------------------------------
+// size_t longestCode
+// -----------------------------------------------------------------------------
+// Description:
+//   finds the longest string in the table that the input starts with
+// Parameters:
+//   HashArray st - the string table
+//   const unsigned char* buf - the input
+//   size_t n - the number of bytes in buf
+//   int* code - set to the code of the string, or EMPTY if there is none
+// Return value:
+//   the length of the string, n if it might go on past the end of buf
+
+static size_t longestCode(HashArray st, const unsigned char* buf, size_t n,
+                          int* code){
+  size_t i;
+  int next;
 
-void encode(Options *opt){
+  *code = EMPTY;
+  for(i = 0; i < n && (next = HashArrayCharPrefixCode(st, buf[i], *code))
+                      != EMPTY; i++){
+    *code = next;
+  }
+
+  return i;
+}
+
+// -----------------------------------------------------------------------------
+// void checkWidth
+// -----------------------------------------------------------------------------
+// Description:
+//   sends INCR_NBITS if the table has grown past the current code width, as
+//   the greedy loop does before each char
+// Parameters:
+//   Encoder enc - the Encoder
+
+static void checkWidth(Encoder enc){
+  if(bitsToRepresent(HashArrayElts(enc->st) + 1) > enc->nbits
+     && enc->nbits + 1 <= enc->maxbits){
+    putBits(enc->out, enc->nbits, INCR_NBITS);
+    enc->nbits++;
+    PROBE2(nbits, enc->nbits, HashArrayElts(enc->st));
+  }
+}
+
+// -----------------------------------------------------------------------------
+// void bestPrune
+// -----------------------------------------------------------------------------
+// Description:
+//   prunes a full table, if pruning is enabled, and tells the decoder
+// Parameters:
+//   Encoder enc - the Encoder
+
+static void bestPrune(Encoder enc){
+  if(enc->window == 0) return;
+
+  enc->st = HashArrayPrune(enc->st, enc->window, enc->escape, enc->timer);
+  putBits(enc->out, enc->nbits, PRUNE);
+  enc->stats.prunes++;
+  enc->nbits = bitsToRepresent(HashArrayElts(enc->st));
+}
+
+// -----------------------------------------------------------------------------
+// void bestParse
+// -----------------------------------------------------------------------------
+// Description:
+//   encodes the input buffered for --best with flexible parsing. Where the
+//   greedy loop always sends the longest string in the table, this also
+//   considers the shorter strings on its prefix chain, and sends the one
+//   after which the next string reaches furthest into the input, which
+//   takes fewer codes to cover the same input. The table is updated exactly
+//   as the decoder updates it for whatever codes are sent: each code sent is
+//   followed by the string of that code plus the next char, even where that
+//   string is already in the table under another code.
+// Parameters:
+//   Encoder enc - the Encoder
+//   int final - 1 if no more input follows before the stream ends or syncs,
+//               0 to leave the input whose parse depends on later bytes
+
+static void bestParse(Encoder enc, int final){
+  const unsigned char* buf = enc->ahead;
+  size_t n = enc->aheadlen, p = 0, len, k, lo, best, reach, r, margin;
+  struct elt* e;
+  int code, next, kar;
+
+  while(p < n){
+    //a char not in the table (only with -e) has to be escaped
+    if((len = longestCode(enc->st, buf + p, n - p, &code)) == 0){
+      kar = buf[p++];
+      checkWidth(enc);
+      PROBE1(escape, kar);
+      putBits(enc->out, enc->nbits, ESCAPE);
+      putBits(enc->out, CHAR_BIT, kar);
+      enc->stats.escapes++;
+      if(HashArrayFreeSpots(enc->st) > 0){
+        HashArrayInsert(enc->st, kar, EMPTY);
+      }
+      else{
+        bestPrune(enc);
+      }
+      continue;
+    }
+
+    //pick how much of the string to send, preferring the longest on a tie.
+    //a shorter one adds a string which is already in the table, wasting a
+    //code, so it has to gain more unless nothing is added any more
+    margin = HashArrayFreeSpots(enc->st) || enc->window ? BEST_MARGIN : 0;
+    best = len;
+    reach = p + len;
+    if(reach < n) reach += longestCode(enc->st, buf + reach, n - reach, &next);
+    lo = len > BEST_CHOICES ? len - BEST_CHOICES : 1;
+    for(k = len - 1; k >= lo && reach < n; k--){
+      r = p + k + longestCode(enc->st, buf + p + k, n - p - k, &next);
+      if(r > reach + margin){
+        reach = r;
+        best = k;
+      }
+    }
+    if(reach == n && !final) break;
+
+    //send the prefix of the string of that length
+    for(e = HashArrayCodeLookup(enc->st, code); e->len > (int)best;
+        e = HashArrayCodeLookup(enc->st, e->prefix));
+    code = e->code;
+    p += best;
+
+    checkWidth(enc);
+    putBits(enc->out, enc->nbits, code);
+    HashArrayUpdateSentTime(enc->st, code, enc->timer++);
+    enc->stats.codes++;
+
+    //add the code plus the next char, unless that char will be escaped
+    if(p < n && HashArrayCharPrefixCode(enc->st, buf[p], EMPTY) != EMPTY){
+      if(HashArrayFreeSpots(enc->st) > 0){
+        HashArrayInsert(enc->st, buf[p], code);
+      }
+      else{
+        bestPrune(enc);
+      }
+    }
+  }
+
+  memmove(enc->ahead, buf + p, n - p);
+  enc->aheadlen = n - p;
+}
+
+// -----------------------------------------------------------------------------
+// void startStream
+// -----------------------------------------------------------------------------
+// Description:
+//   sets up an Encoder for a new stream and writes the stream header, but
+//   leaves the string table to the caller
+// Parameters:
+//   Encoder enc - the Encoder to set up
+//   Options* opt - a pointer to an options struct containing the maxbits,
+//                  window and escape values to encode with
+
+static void startStream(Encoder enc, Options* opt){
+  BitWriter out = enc->out;
   int maxbits = opt->maxbits;
-  int window = opt->prune;
+  int64_t window = opt->prune;
   int escape = opt->escape;
-  int kar, code, nbits;
-  int timer = 1;
+
+  enc->maxbits = maxbits;
+  enc->window = window;
+  enc->escape = escape;
+  enc->code = EMPTY;
+  enc->timer = 1;
+  enc->outstart = bytesWritten(out);
+  memset(&enc->stats, 0, sizeof(enc->stats));
 
   // send options data at the beginning of the file
-  putBits(BITS_TO_SEND_MAXBITS, maxbits);
-  putBits(BITS_TO_SEND_WINDOW, window);
-  putBits(BITS_TO_SEND_ESCAPE, escape);
+  // the original header is used whenever the options fit in it
+  if(maxbits <= LEGACY_MAXBITS && window < (1 << BITS_TO_SEND_WINDOW)){
+    putBits(out, BITS_TO_SEND_MAXBITS, maxbits);
+    putBits(out, BITS_TO_SEND_WINDOW, window);
+  }
+  else{
+    putBits(out, BITS_TO_SEND_MAXBITS, HEADER_EXTENDED | maxbits);
+    putBits(out, BITS_TO_SEND_WINDOW_EXT / 2,
+            (int)((uint64_t)window >> (BITS_TO_SEND_WINDOW_EXT / 2)));
+    putBits(out, BITS_TO_SEND_WINDOW_EXT / 2,
+            (int)((uint64_t)window & 0xFFFFFF));
+  }
+  putBits(out, BITS_TO_SEND_ESCAPE, escape);
 
-  struct elt* e;
+  if(escape){
+    enc->nbits = 3;
+  }
+  else{
+    enc->nbits = CHAR_BIT + 1;
+  }
+}
 
-  HashArray st = HashArrayCreate(1 << maxbits, escape);
+// -----------------------------------------------------------------------------
+// Encoder newEncoder
+// -----------------------------------------------------------------------------
+// Description:
+//   creates an encoder around a string table that is already allocated, and
+//   writes the stream header
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the parameters
+//   BitWriter out - where the compressed stream is written
+//   HashArray st - an empty string table of the size opt->maxbits gives
 
-  if(escape){
-    nbits = 3;
+static Encoder newEncoder(Options* opt, BitWriter out, HashArray st){
+  Encoder enc = malloc(sizeof(*enc));
+
+  enc->out = out;
+  enc->lm = 0;
+  enc->ahead = 0;
+  startStream(enc, opt);
+  enc->st = st;
+  longMatchSetup(enc, opt->longmatch);
+  bestSetup(enc, opt->best);
+
+  return enc;
+}
+
+Encoder encoderCreate(Options* opt, BitWriter out){
+  return newEncoder(opt, out, HashArrayCreate(1 << opt->maxbits, opt->escape));
+}
+
+Encoder encoderTryCreate(Options* opt, BitWriter out){
+  HashArray st = HashArrayTryCreate(1 << opt->maxbits, opt->escape);
+
+  return st ? newEncoder(opt, out, st) : 0;
+}
+
+void encoderReset(Encoder enc, Options* opt){
+  startStream(enc, opt);
+
+  if(HashArraySize(enc->st) == 1 << opt->maxbits){
+    HashArrayReset(enc->st, opt->escape);
   }
   else{
-    nbits = CHAR_BIT + 1;
+    HashArrayDestroy(enc->st);
+    enc->st = HashArrayCreate(1 << opt->maxbits, opt->escape);
+  }
+  longMatchSetup(enc, opt->longmatch);
+  bestSetup(enc, opt->best);
+}
+
+void encoderWrite(Encoder enc, const unsigned char* buf, size_t n){
+  int maxbits = enc->maxbits;
+  int64_t window = enc->window;
+  int escape = enc->escape;
+  int nbits = enc->nbits;
+  int code = enc->code;
+  int64_t timer = enc->timer;
+  HashArray st = enc->st;
+  BitWriter out = enc->out;
+  struct longmatch* lm = enc->lm;
+  uint64_t codes = 0, escapes = 0, prunes = 0, base = 0;
+  size_t i = 0;
+  int kar, found;
+
+  //with --best the input is buffered, and parsed once enough of it is known
+  if(enc->ahead){
+    if(enc->aheadlen + n > enc->aheadcap){
+      while(enc->aheadlen + n > enc->aheadcap) enc->aheadcap *= 2;
+      enc->ahead = realloc(enc->ahead, enc->aheadcap);
+    }
+    memcpy(enc->ahead + enc->aheadlen, buf, n);
+    enc->aheadlen += n;
+    enc->stats.bytesin += n;
+    bestParse(enc, 0);
+    return;
+  }
+
+  //the history must hold all of buf, so long inputs go a piece at a time
+  if(lm){
+    if(n > LONGMATCH_HISTORY / 2){
+      for(; i < n; i += LONGMATCH_HISTORY / 2){
+        encoderWrite(enc, buf + i, n - i < LONGMATCH_HISTORY / 2
+                                   ? n - i : LONGMATCH_HISTORY / 2);
+      }
+      return;
+    }
+    base = lm->histend;
+    longMatchInput(lm, buf, n);
   }
 
-  code = EMPTY;
   //encoding loop
-  while((kar = getchar()) != EOF){
+  //i is only advanced once a char is used up, so a char which has to be
+  //looked at again (after an escape or prune) just goes round once more
+  while(i < n){
+    kar = buf[i];
 
     //increment nbits if necessary
     if(bitsToRepresent(HashArrayElts(st) + 1) > nbits
       && (nbits + 1) <= maxbits){
-        putBits(nbits, INCR_NBITS);
+        putBits(out, nbits, INCR_NBITS);
         nbits++;
-    } 
+        PROBE2(nbits, nbits, HashArrayElts(st));
+    }
 
-    //========== main encoding algorithm ========== 
+    //========== main encoding algorithm ==========
 
     //if the pair is in the table, use it and look for next char
-    if((e = HashArrayCharPrefixLookup(st, kar, code))){
-      code = e->code;
+    if((found = HashArrayCharPrefixCode(st, kar, code)) != EMPTY){
+      if(lm && code == EMPTY){
+        lm->start = base + i;
+        lm->root = found;
+        i++;
+        code = longMatch(lm, st, found, buf, &i, n);
+        continue;
+      }
+      code = found;
+      i++;
     }
     //if the pair is not found
     else{
       if(code == EMPTY){
         //if (kar, EMPTY) isn't in the table, need to send escape code
-        putBits(nbits, ESCAPE);
-        putBits(CHAR_BIT, kar);
+        PROBE1(escape, kar);
+        putBits(out, nbits, ESCAPE);
+        putBits(out, CHAR_BIT, kar);
+        escapes++;
+        i++;
 
         if(HashArrayFreeSpots(st) > 0){
           HashArrayInsert(st, kar, EMPTY);
         }
-        else if(window != 0){ 
+        else if(window != 0){
           st = HashArrayPrune(st, window, escape, timer);
-          putBits(nbits, PRUNE);
+          putBits(out, nbits, PRUNE);
+          prunes++;
           nbits = bitsToRepresent(HashArrayElts(st));
+          if(lm) memset(lm->ext, 0, lm->size * sizeof(*lm->ext));
         }
         continue;
       }
       else{
         //output the code
-        putBits(nbits, code);
+        putBits(out, nbits, code);
         HashArrayUpdateSentTime(st, code, timer++);
+        codes++;
       }
 
-      e = HashArrayCharPrefixLookup(st, kar, EMPTY);
-      if(e != NULL){
+      found = HashArrayCharPrefixCode(st, kar, EMPTY);
+      if(found != EMPTY){
         //insert code, kar into string table
         //if we can't insert and pruning is enabled, then prune
         if(HashArrayFreeSpots(st) > 0){
           HashArrayInsert(st, kar, code);
+          if(lm) longMatchRemember(lm, HashArrayElts(st) - 1);
         }
-        else if(window != 0){ 
+        else if(window != 0){
           st = HashArrayPrune(st, window, escape, timer);
-          putBits(nbits, PRUNE);
+          putBits(out, nbits, PRUNE);
+          prunes++;
           nbits = bitsToRepresent(HashArrayElts(st));
+          if(lm) memset(lm->ext, 0, lm->size * sizeof(*lm->ext));
 
           //we need to find kar,EMPTY in the new table
-          e = HashArrayCharPrefixLookup(st, kar, EMPTY);
+          //with -e it may have been pruned, in which case it is escaped again
+          found = HashArrayCharPrefixCode(st, kar, EMPTY);
+          if(found == EMPTY){
+            code = EMPTY;
+            continue;
+          }
+        }
+        else if(lm){
+          longMatchRemember(lm, code);
         }
 
         //set code to index of (kar, EMPTY) in table
-        code = e->code;
+        code = found;
+        i++;
+        if(lm){
+          lm->start = base + i - 1;
+          lm->root = code;
+          code = longMatch(lm, st, code, buf, &i, n);
+        }
       }
       else{
         //the char we need to add on isn't in the table yet
         //we need to send escape code for this char first
-        ungetc(kar, stdin);
         code = EMPTY;
       }
 
     }
   }
 
+  enc->nbits = nbits;
+  enc->code = code;
+  enc->timer = timer;
+  enc->st = st;
+  enc->stats.bytesin += n;
+  enc->stats.codes += codes;
+  enc->stats.escapes += escapes;
+  enc->stats.prunes += prunes;
+}
+
+void encoderFinish(Encoder enc){
+  if(enc->ahead) bestParse(enc, 1);
+
   //output code if not empty at the end
-  if(code != EMPTY){
-    putBits(nbits, code);
-    HashArrayUpdateSentTime(st, code, timer++);
+  if(enc->code != EMPTY){
+    putBits(enc->out, enc->nbits, enc->code);
+    HashArrayUpdateSentTime(enc->st, enc->code, enc->timer++);
+    enc->stats.codes++;
+    enc->code = EMPTY;
   }
 
   //output any extra bits left over
-  sendRemainingBits();
+  sendRemainingBits(enc->out);
+}
+
+void encoderSync(Encoder enc){
+  if(enc->ahead) bestParse(enc, 1);
+
+  if(enc->code != EMPTY){
+    putBits(enc->out, enc->nbits, enc->code);
+    HashArrayUpdateSentTime(enc->st, enc->code, enc->timer++);
+    enc->stats.codes++;
+    enc->code = EMPTY;
+  }
+
+  putBits(enc->out, enc->nbits, SYNC);
+  padBits(enc->out);
+}
+
+void encoderFlush(Encoder enc){
+  encoderSync(enc);
+  sendRemainingBits(enc->out);
+}
+
+void encoderSave(Encoder enc, FILE* f){
+  encoderFlush(enc);
+
+  fputs(CHECKPOINT_MAGIC, f);
+  writeNumber(f, CHECKPOINT_VERSION, 1);
+  writeNumber(f, enc->maxbits, 1);
+  writeNumber(f, enc->window, 8);
+  writeNumber(f, enc->escape, 1);
+  writeNumber(f, enc->nbits, 1);
+  writeNumber(f, enc->timer, 8);
+  HashArraySave(enc->st, f);
+}
+
+// -----------------------------------------------------------------------------
+// int readCheckpointHeader
+// -----------------------------------------------------------------------------
+// Description:
+//   reads and checks the fields of a checkpoint before its string table
+// Parameters:
+//   FILE* f - the checkpoint file to read from
+//   Options* opt - set to the parameters saved in the checkpoint
+//   uint64_t* nbits - set to the saved code width
+//   uint64_t* timer - set to the saved timer
+// Return value:
+//   0 if the fields are valid, -1 otherwise
+
+static int readCheckpointHeader(FILE* f, Options* opt, uint64_t* nbits,
+                                uint64_t* timer){
+  char magic[sizeof(CHECKPOINT_MAGIC)] = "";
+  uint64_t version, maxbits, window, escape;
+
+  if(fread(magic, 1, sizeof(magic) - 1, f) != sizeof(magic) - 1
+     || strcmp(magic, CHECKPOINT_MAGIC)
+     || readNumber(f, &version, 1) || version != CHECKPOINT_VERSION
+     || readNumber(f, &maxbits, 1) || readNumber(f, &window, 8)
+     || readNumber(f, &escape, 1) || readNumber(f, nbits, 1)
+     || readNumber(f, timer, 8)
+     || maxbits < MIN_MAXBITS || maxbits > MAX_MAXBITS || escape > 1
+     || *nbits > maxbits || (int64_t)window < 0 || (int64_t)*timer < 1){
+    return -1;
+  }
+
+  opt->maxbits = maxbits;
+  opt->prune = window;
+  opt->escape = escape;
+  return 0;
+}
+
+int encoderCheckpointParameters(FILE* f, Options* opt){
+  uint64_t nbits, timer;
+
+  return readCheckpointHeader(f, opt, &nbits, &timer);
+}
+
+Encoder encoderRestore(FILE* f, Options* opt, BitWriter out){
+  uint64_t nbits, timer;
+  Encoder enc;
+  HashArray st;
+
+  if(readCheckpointHeader(f, opt, &nbits, &timer) != 0
+     || (st = HashArrayLoad(f, 1 << opt->maxbits)) == 0){
+    return 0;
+  }
+
+  enc = malloc(sizeof(*enc));
+  enc->maxbits = opt->maxbits;
+  enc->window = opt->prune;
+  enc->escape = opt->escape;
+  enc->nbits = nbits;
+  enc->code = EMPTY;
+  enc->timer = timer;
+  enc->st = st;
+  enc->out = out;
+  enc->outstart = bytesWritten(out);
+  memset(&enc->stats, 0, sizeof(enc->stats));
+  enc->lm = 0;
+  enc->ahead = 0;
+  longMatchSetup(enc, opt->longmatch);
+  bestSetup(enc, opt->best);
+
+  return enc;
+}
+
+void encoderStats(Encoder enc, EncoderStats* stats){
+  *stats = enc->stats;
+  stats->bytesout = bytesWritten(enc->out) - enc->outstart;
+  HashArrayHotStats(enc->st, &stats->lookups, &stats->hits);
+}
+
+void printEncoderStats(FILE* f, EncoderStats* stats){
+  fprintf(f, "%" PRIu64 " bytes in, %" PRIu64 " bytes out (%.1f%%), %" PRIu64
+          " codes, %" PRIu64 " escapes, %" PRIu64 " prunes\n",
+          stats->bytesin, stats->bytesout,
+          stats->bytesin ? 100.0 * stats->bytesout / stats->bytesin : 0.0,
+          stats->codes, stats->escapes, stats->prunes);
+  if(stats->lookups){
+    fprintf(f, "%" PRIu64 " table lookups, %.1f%% hit the hot index\n",
+            stats->lookups, 100.0 * stats->hits / stats->lookups);
+  }
+}
+
+void encoderDestroy(Encoder enc){
+  longMatchSetup(enc, 0);
+  bestSetup(enc, 0);
+  HashArrayDestroy(enc->st);
+  free(enc);
+}
+
+// -----------------------------------------------------------------------------
+// int64_t milliseconds
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the current time of a monotonic clock in milliseconds
+
+static int64_t milliseconds(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// -----------------------------------------------------------------------------
+// void feed
+// -----------------------------------------------------------------------------
+// Description:
+//   passes input to the encoder, and to the verifier first if there is one
+// Parameters:
+//   Encoder enc - the Encoder to compress with
+//   Verifier v - the Verifier checking the stream, or a null pointer
+//   const unsigned char* buf - the bytes to compress
+//   size_t n - the number of bytes in buf
+
+static void feed(Encoder enc, Verifier v, const unsigned char* buf, size_t n){
+  if(v) verifierInput(v, buf, n);
+  encoderWrite(enc, buf, n);
+}
+
+// -----------------------------------------------------------------------------
+// void encodeLive
+// -----------------------------------------------------------------------------
+// Description:
+//   the encoding loop for --flush-ms and --flush-on-newline. Reads whatever is
+//   available on stdin, and flushes the stream to stdout after the last
+//   newline read, or when data has been waiting for flushms milliseconds.
+// Parameters:
+//   Encoder enc - the Encoder to compress with
+//   Verifier v - the Verifier checking the stream, or a null pointer
+//   Options* opt - a pointer to an options struct with the flush settings
+//   unsigned char* buf - a buffer of ENCODE_BUFSIZE bytes
+
+static void encodeLive(Encoder enc, Verifier v, Options* opt,
+                       unsigned char* buf){
+  struct pollfd pfd = {.fd = fileno(stdin), .events = POLLIN};
+  int64_t deadline = -1;
+  unsigned char* nl;
+  ssize_t n, done;
+  int timeout;
+
+  for(;;){
+    timeout = -1;
+    if(deadline >= 0){
+      timeout = deadline - milliseconds();
+      if(timeout < 0) timeout = 0;
+    }
+
+    n = poll(&pfd, 1, timeout);
+    if(n == 0){
+      //data has waited long enough
+      encoderFlush(enc);
+      fflush(stdout);
+      deadline = -1;
+      continue;
+    }
+    if(n > 0) n = read(pfd.fd, buf, ENCODE_BUFSIZE);
+    if(n < 0){
+      if(errno == EINTR) continue;
+      fprintf(stderr, "Error: could not read input\n");
+      exit(EXIT_FAILURE);
+    }
+    if(n == 0) break;
+
+    //lines after the last newline read are flushed together
+    done = 0;
+    if(opt->flushnewline && (nl = memrchr(buf, '\n', n)) != 0){
+      done = nl - buf + 1;
+      feed(enc, v, buf, done);
+      encoderFlush(enc);
+      fflush(stdout);
+      deadline = -1;
+    }
+    if(done < n){
+      feed(enc, v, buf + done, n - done);
+      if(opt->flushms && deadline < 0) deadline = milliseconds() + opt->flushms;
+    }
+  }
+}
+
+void encode(Options* opt, ByteSource in, void* ctx){
+  unsigned char* buf = malloc(ENCODE_BUFSIZE);
+  Verifier v = opt->verify ? verifierCreate(stdout) : 0;
+  BitWriter out = v ? bitWriterCreate(verifierSink, v)
+                    : bitWriterCreate(fileSink, stdout);
+  Encoder enc;
+  FILE* f;
+  size_t n;
+
+  if(opt->resume){
+    if((f = fopen(opt->resume, "rb")) == 0
+       || (enc = encoderRestore(f, opt, out)) == 0){
+      fprintf(stderr, "Error: %s is not a valid checkpoint.\n", opt->resume);
+      exit(EXIT_FAILURE);
+    }
+    fclose(f);
+  }
+  else{
+    enc = encoderCreate(opt, out);
+  }
+
+  if(opt->flushms || opt->flushnewline){
+    encodeLive(enc, v, opt, buf);
+  }
+  else{
+    while((n = in(ctx, buf, ENCODE_BUFSIZE)) > 0){
+      feed(enc, v, buf, n);
+    }
+  }
+
+  if(opt->checkpoint){
+    //write to a temporary file first, so a failed run keeps the old one
+    char* tmp = malloc(strlen(opt->checkpoint) + 5);
+    sprintf(tmp, "%s.tmp", opt->checkpoint);
+    if((f = fopen(tmp, "wb")) == 0){
+      fprintf(stderr, "Error: could not write checkpoint %s.\n", tmp);
+      exit(EXIT_FAILURE);
+    }
+    encoderSave(enc, f);
+    if(fclose(f) != 0 || fflush(stdout) != 0
+       || rename(tmp, opt->checkpoint) != 0){
+      fprintf(stderr, "Error: could not write checkpoint %s.\n",
+              opt->checkpoint);
+      exit(EXIT_FAILURE);
+    }
+    free(tmp);
+  }
+  else{
+    encoderFinish(enc);
+  }
+
+  if(v) verifierFinish(v);
+
+  if(opt->stats){
+    EncoderStats stats;
+    encoderStats(enc, &stats);
+    printEncoderStats(stderr, &stats);
+  }
 
-  HashArrayDestroy(st);
+  encoderDestroy(enc);
+  bitWriterDestroy(out);
+  free(buf);
 }
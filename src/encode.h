@@ -5,14 +5,211 @@ contains function declaration for the LZW encoder
 by Geoffrey Litt
 */
 
+typedef struct encoder *Encoder;
+
+// -----------------------------------------------------------------------------
+// struct encoderstats
+// -----------------------------------------------------------------------------
+// Description:
+//   counters describing the work done by an Encoder since it was created or
+//   last reset
+// Fields:
+//   uint64_t bytesin - the number of bytes compressed
+//   uint64_t bytesout - the number of compressed bytes written
+//   uint64_t codes - the number of string codes sent
+//   uint64_t escapes - the number of escape codes sent
+//   uint64_t prunes - the number of times the string table was pruned
+//   uint64_t lookups - the number of string table lookups tried in its hot
+//                      index, 0 for tables too small to have one
+//   uint64_t hits - the number of them answered by the hot index
+
+typedef struct encoderstats{
+  uint64_t bytesin;
+  uint64_t bytesout;
+  uint64_t codes;
+  uint64_t escapes;
+  uint64_t prunes;
+  uint64_t lookups;
+  uint64_t hits;
+} EncoderStats;
+
+// -----------------------------------------------------------------------------
+// Encoder encoderCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   creates an encoder which compresses bytes pushed to it with encoderWrite,
+//   and writes the stream header to a BitWriter
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the maxbits,
+//                  window and escape values to encode with
+//   BitWriter out - where the compressed stream is written
+// Return value:
+//   a new Encoder
+
+Encoder encoderCreate(Options* opt, BitWriter out);
+
+// -----------------------------------------------------------------------------
+// Encoder encoderTryCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   creates an encoder like encoderCreate, but returns instead of exiting the
+//   program if its string table can't be allocated. Nothing is written then.
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the parameters
+//   BitWriter out - where the compressed stream is written
+// Return value:
+//   a new Encoder, or a null pointer if there isn't enough memory
+
+Encoder encoderTryCreate(Options* opt, BitWriter out);
+
+// -----------------------------------------------------------------------------
+// void encoderReset
+// -----------------------------------------------------------------------------
+// Description:
+//   starts a new stream on an existing Encoder, as if it had just been created
+//   with encoderCreate, but reusing its string table memory when maxbits is
+//   unchanged. The previous stream should have been finished first.
+// Parameters:
+//   Encoder enc - the Encoder to reset
+//   Options* opt - a pointer to an options struct containing the maxbits,
+//                  window and escape values for the new stream
+
+void encoderReset(Encoder enc, Options* opt);
+
+// -----------------------------------------------------------------------------
+// void encoderWrite
+// -----------------------------------------------------------------------------
+// Description:
+//   compresses a buffer of bytes. Matches may continue across calls, so the
+//   code for the last bytes is only sent by later calls or encoderFinish.
+// Parameters:
+//   Encoder enc - the Encoder to compress with
+//   const unsigned char* buf - the bytes to compress
+//   size_t n - the number of bytes in buf
+
+void encoderWrite(Encoder enc, const unsigned char* buf, size_t n);
+
+// -----------------------------------------------------------------------------
+// void encoderFinish
+// -----------------------------------------------------------------------------
+// Description:
+//   ends the stream: sends the pending code and any bits left over
+// Parameters:
+//   Encoder enc - the Encoder to finish
+
+void encoderFinish(Encoder enc);
+
+// -----------------------------------------------------------------------------
+// void encoderSync
+// -----------------------------------------------------------------------------
+// Description:
+//   sends the pending code followed by a SYNC code, and pads the stream to a
+//   whole byte. A decoder can then output everything written so far.
+//   The string table is kept, and more bytes may be written afterwards.
+// Parameters:
+//   Encoder enc - the Encoder to sync
+
+void encoderSync(Encoder enc);
+
+// -----------------------------------------------------------------------------
+// void encoderFlush
+// -----------------------------------------------------------------------------
+// Description:
+//   syncs the stream with encoderSync and hands everything written so far to
+//   the BitWriter's sink, so that a decoder at the other end of a pipe or
+//   socket can output all of the input written so far. Sinks which buffer
+//   (like stdio files) still have to be flushed by the caller.
+// Parameters:
+//   Encoder enc - the Encoder to flush
+
+void encoderFlush(Encoder enc);
+
+// -----------------------------------------------------------------------------
+// void encoderSave
+// -----------------------------------------------------------------------------
+// Description:
+//   flushes the stream with encoderFlush, and saves the encoder state
+//   (parameters, nbits, timer and string table) to a checkpoint file. After
+//   the sync the stream is byte aligned, so no partial byte has to be saved.
+// Parameters:
+//   Encoder enc - the Encoder to save
+//   FILE* f - the checkpoint file to write to
+
+void encoderSave(Encoder enc, FILE* f);
+
+// -----------------------------------------------------------------------------
+// Encoder encoderRestore
+// -----------------------------------------------------------------------------
+// Description:
+//   creates an encoder from a checkpoint written by encoderSave. Its output
+//   continues the saved stream, so no header is written: appending it to the
+//   output of the saved encoder gives one stream which decodes to everything
+//   written to either encoder.
+// Parameters:
+//   FILE* f - the checkpoint file to read from
+//   Options* opt - set to the parameters saved in the checkpoint
+//   BitWriter out - where the rest of the compressed stream is written
+// Return value:
+//   a new Encoder, or a null pointer if the checkpoint is invalid
+
+Encoder encoderRestore(FILE* f, Options* opt, BitWriter out);
+
+// -----------------------------------------------------------------------------
+// int encoderCheckpointParameters
+// -----------------------------------------------------------------------------
+// Description:
+//   reads the parameters saved in a checkpoint, without loading its string
+//   table
+// Parameters:
+//   FILE* f - the checkpoint file to read from
+//   Options* opt - set to the parameters saved in the checkpoint
+// Return value:
+//   0 if the checkpoint starts validly, -1 otherwise
+
+int encoderCheckpointParameters(FILE* f, Options* opt);
+
+// -----------------------------------------------------------------------------
+// void encoderStats
+// -----------------------------------------------------------------------------
+// Description:
+//   reports the counters of an Encoder
+// Parameters:
+//   Encoder enc - the Encoder to examine
+//   EncoderStats* stats - where the counters are stored
+
+void encoderStats(Encoder enc, EncoderStats* stats);
+
+// -----------------------------------------------------------------------------
+// void printEncoderStats
+// -----------------------------------------------------------------------------
+// Description:
+//   prints the counters of an Encoder on one line
+// Parameters:
+//   FILE* f - the file to print to
+//   EncoderStats* stats - the counters to print
+
+void printEncoderStats(FILE* f, EncoderStats* stats);
+
+// -----------------------------------------------------------------------------
+// void encoderDestroy
+// -----------------------------------------------------------------------------
+// Description:
+//   frees an Encoder and its string table. The BitWriter is not freed.
+// Parameters:
+//   Encoder enc - the Encoder to destroy
+
+void encoderDestroy(Encoder enc);
+
 // -----------------------------------------------------------------------------
 // void encode
 // -----------------------------------------------------------------------------
 // Description:
-//  compresses a bytestream from stdin using the LZW algorithm,
+//  compresses a bytestream using the LZW algorithm,
 //  outputs the compressed bytestream to stdout
 // Parameters:
 //   Options* opt - a pointer to an options struct containing parameters for
 //                  the program's operation
+//   ByteSource in - the function supplying the bytes to compress
+//   void* ctx - the context pointer for in
 
-void encode(Options* opt);
\ No newline at end of file
+void encode(Options* opt, ByteSource in, void* ctx);
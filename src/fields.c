@@ -0,0 +1,308 @@
+/*
+fields.c
+contains implementation code for field mode
+*/
+
+#include "globals.h"
+#include "bitio.h"
+#include "encode.h"
+#include "decode.h"
+#include "budget.h"
+#include "fields.h"
+
+#define FIELDS_BLOCKSIZE (1 << 20)   //input bytes compressed per block
+
+// -----------------------------------------------------------------------------
+// struct column
+// -----------------------------------------------------------------------------
+// Description:
+//   the state of one column, on either side
+// Fields:
+//   Encoder enc - compresses the column, when encoding
+//   Decoder dec - decompresses the column, when decoding
+//   BitWriter out - writes the column's compressed bytes when encoding, or
+//                   its decompressed bytes when decoding, to data
+//   BitReader in - reads the column's compressed bytes from packed
+//   unsigned char* data - the bytes of the current block, compressed when
+//                         encoding and decompressed when decoding
+//   size_t len - the number of bytes in data
+//   size_t cap - the number of bytes allocated for data
+//   size_t pos - the number of bytes of data already used
+//   unsigned char* packed - the compressed bytes of the block, when decoding
+//   size_t packedlen - the number of bytes in packed
+//   size_t packedcap - the number of bytes allocated for packed
+//   size_t packedpos - the number of bytes of packed already read
+//   uint64_t fed - the number of compressed bytes given to in so far
+
+struct column{
+  Encoder enc;
+  Decoder dec;
+  BitWriter out;
+  BitReader in;
+  unsigned char* data;
+  size_t len;
+  size_t cap;
+  size_t pos;
+  unsigned char* packed;
+  size_t packedlen;
+  size_t packedcap;
+  size_t packedpos;
+  uint64_t fed;
+};
+
+// -----------------------------------------------------------------------------
+// size_t columnSink, columnSource
+// -----------------------------------------------------------------------------
+// Description:
+//   a ByteSink which appends to a column's data, and a ByteSource which
+//   supplies the column's packed bytes, ctx is the struct column*
+
+static size_t columnSink(void* ctx, const unsigned char* buf, size_t n){
+  struct column* c = ctx;
+
+  if(c->len + n > c->cap){
+    c->cap = c->len + n > 2 * c->cap ? c->len + n : 2 * c->cap;
+    c->data = realloc(c->data, c->cap);
+  }
+  memcpy(c->data + c->len, buf, n);
+  c->len += n;
+
+  return n;
+}
+
+static size_t columnSource(void* ctx, unsigned char* buf, size_t n){
+  struct column* c = ctx;
+
+  if(n > c->packedlen - c->packedpos) n = c->packedlen - c->packedpos;
+  memcpy(buf, c->packed + c->packedpos, n);
+  c->packedpos += n;
+  c->fed += n;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void writeBlock
+// -----------------------------------------------------------------------------
+// Description:
+//   flushes the columns that received bytes in this block, and writes them
+// Parameters:
+//   struct column* cols - the columns
+//   int* touched - for each column, 1 if it received bytes in this block,
+//                  cleared here
+
+static void writeBlock(struct column* cols, int* touched){
+  int i, count = 0;
+
+  for(i = 0; i < FIELDS_MAXCOLUMNS; i++){
+    count += touched[i];
+  }
+  putchar(count);
+
+  for(i = 0; i < FIELDS_MAXCOLUMNS; i++){
+    if(!touched[i]) continue;
+    encoderFlush(cols[i].enc);
+    putchar(i);
+    writeNumber(stdout, cols[i].len, 4);
+    fwrite(cols[i].data, 1, cols[i].len, stdout);
+    cols[i].len = 0;
+    touched[i] = 0;
+  }
+}
+
+void fieldsEncode(Options* opt, ByteSource in, void* ctx){
+  struct column cols[FIELDS_MAXCOLUMNS];
+  int touched[FIELDS_MAXCOLUMNS];
+  unsigned char* buf = malloc(FIELDS_BLOCKSIZE);
+  unsigned char delim = opt->delimiter, sep = opt->separator;
+  EncoderStats stats, total;
+  size_t n, i, j, end;
+  int col = 0;
+  struct column* c;
+
+  memset(cols, 0, sizeof(cols));
+  memset(touched, 0, sizeof(touched));
+  memset(&total, 0, sizeof(total));
+
+  fputs(FIELDS_MAGIC, stdout);
+  putchar(FIELDS_VERSION);
+  putchar(delim);
+  putchar(sep);
+
+  while((n = in(ctx, buf, FIELDS_BLOCKSIZE)) > 0){
+    for(i = 0; i < n; i = end){
+      //find the end of the field, which may be in a later block
+      for(j = i; j < n && buf[j] != delim && buf[j] != sep; j++);
+      end = j < n ? j + 1 : n;
+
+      c = &cols[col];
+      if(!c->enc){
+        c->out = bitWriterCreate(columnSink, c);
+        c->enc = encoderCreate(opt, c->out);
+      }
+      encoderWrite(c->enc, buf + i, end - i);
+      touched[col] = 1;
+
+      if(j < n){
+        if(buf[j] == sep) col = 0;
+        else if(col < FIELDS_MAXCOLUMNS - 1) col++;
+      }
+    }
+    writeBlock(cols, touched);
+  }
+  putchar(0);
+
+  if(fflush(stdout) != 0){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = 0; i < FIELDS_MAXCOLUMNS; i++){
+    if(!cols[i].enc) continue;
+    if(opt->stats){
+      encoderStats(cols[i].enc, &stats);
+      fprintf(stderr, "column %zu: ", i);
+      printEncoderStats(stderr, &stats);
+      total.bytesin += stats.bytesin;
+      total.bytesout += stats.bytesout;
+      total.codes += stats.codes;
+      total.escapes += stats.escapes;
+      total.prunes += stats.prunes;
+      total.lookups += stats.lookups;
+      total.hits += stats.hits;
+    }
+    encoderDestroy(cols[i].enc);
+    bitWriterDestroy(cols[i].out);
+    free(cols[i].data);
+  }
+  if(opt->stats){
+    fprintf(stderr, "total: ");
+    printEncoderStats(stderr, &total);
+  }
+
+  free(buf);
+}
+
+// -----------------------------------------------------------------------------
+// void corrupt
+// -----------------------------------------------------------------------------
+// Description:
+//   reports a corrupt field stream and exits
+// Parameters:
+//   uint64_t block - the number of the block where the problem was found
+//   int col - the column where it was found, or -1 if not in a column
+
+static void corrupt(uint64_t block, int col){
+  if(col < 0){
+    fprintf(stderr, "Error: input file corrupted in block %" PRIu64 "\n",
+            block);
+  }
+  else{
+    fprintf(stderr, "Error: input file corrupted in column %d of block %"
+            PRIu64 "\n", col, block);
+  }
+  exit(EXIT_FAILURE);
+}
+
+void fieldsDecode(Options* opt, FILE* in){
+  struct column cols[FIELDS_MAXCOLUMNS];
+  int seen[FIELDS_MAXCOLUMNS];
+  Options streamopt = {.maxbits = 0};
+  uint64_t block, len, produced = 0, memory = 0;
+  int delim, sep, count, col = 0, i, k;
+  unsigned char *p, *start, *stop;
+  struct column* c;
+
+  memset(cols, 0, sizeof(cols));
+
+  if(getc(in) != FIELDS_VERSION || (delim = getc(in)) == EOF
+     || (sep = getc(in)) == EOF || delim == sep){
+    fprintf(stderr, "Error: input file corrupted at byte 4\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(block = 0; (count = getc(in)) != 0; block++){
+    if(count == EOF || count > FIELDS_MAXCOLUMNS) corrupt(block, -1);
+    memset(seen, 0, sizeof(seen));
+
+    //decompress this block of each column
+    for(k = 0; k < count; k++){
+      if((i = getc(in)) == EOF || i >= FIELDS_MAXCOLUMNS
+         || readNumber(in, &len, 4) != 0){
+        corrupt(block, -1);
+      }
+      c = &cols[i];
+      if(seen[i]) corrupt(block, i);
+      seen[i] = 1;
+
+      if(len > c->packedcap){
+        c->packedcap = len;
+        c->packed = realloc(c->packed, c->packedcap);
+      }
+      if(fread(c->packed, 1, len, in) != len) corrupt(block, i);
+      c->packedlen = len;
+      c->packedpos = 0;
+      c->len = c->pos = 0;
+
+      if(!c->dec){
+        c->in = bitReaderCreate(columnSource, c);
+        if(decoderReadHeader(c->in, &streamopt) != 0) corrupt(block, i);
+        memory += memoryFootprint(&streamopt);
+        if(opt->maxmemory && memory > opt->maxmemory){
+          fprintf(stderr, "Error: stream needs %" PRIu64 " bytes of memory, "
+                  "more than --max-memory allows.\n", memory);
+          exit(EXIT_FAILURE);
+        }
+        c->out = bitWriterCreate(columnSink, c);
+        c->dec = decoderCreate(&streamopt, c->in, c->out);
+      }
+
+      //each block of a column ends at a sync point, where the column's
+      //bytes have all been read
+      if(decoderRun(c->dec) != DECODE_SYNC
+         || bitsRead(c->in) != c->fed * CHAR_BIT){
+        corrupt(block, i);
+      }
+      sendRemainingBits(c->out);
+    }
+
+    //rebuild the records, until the current column runs out
+    for(;;){
+      c = &cols[col];
+      if(c->pos == c->len) break;
+      start = c->data + c->pos;
+      stop = c->data + c->len;
+      for(p = start; p < stop && *p != delim && *p != sep; p++);
+      if(p < stop){
+        if(*p == sep) col = 0;
+        else if(col < FIELDS_MAXCOLUMNS - 1) col++;
+        p++;
+      }
+      if(!opt->scan) fwrite(start, 1, p - start, stdout);
+      produced += p - start;
+      c->pos += p - start;
+    }
+    for(i = 0; i < FIELDS_MAXCOLUMNS; i++){
+      if(cols[i].pos != cols[i].len) corrupt(block, i);
+    }
+  }
+
+  if(getc(in) != EOF) corrupt(block, -1);
+
+  if(fflush(stdout) != 0){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+  if(opt->scan){
+    printf("%" PRIu64 "\n", produced);
+  }
+
+  for(i = 0; i < FIELDS_MAXCOLUMNS; i++){
+    if(!cols[i].dec) continue;
+    decoderDestroy(cols[i].dec);
+    bitReaderDestroy(cols[i].in);
+    bitWriterDestroy(cols[i].out);
+    free(cols[i].data);
+    free(cols[i].packed);
+  }
+}
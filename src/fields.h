@@ -0,0 +1,55 @@
+/*
+fields.h
+contains declarations for field mode, which compresses each column of
+delimited records (like CSV files and structured logs) with its own string
+table
+
+Each field is sent, together with the delimiter or record separator ending
+it, to the stream of its column: the first field of every record to column 0,
+the second to column 1, and so on, with any fields past the last column going
+to the last column. The decoder rebuilds the records by taking bytes from the
+columns in the same order, switching column at each delimiter and going back
+to column 0 at each record separator.
+
+A field stream starts with the magic "LZWF", a version byte, the delimiter
+and the record separator. The input is compressed in blocks. At the end of
+each block every column that received bytes is flushed, so its stream is at a
+sync point, and the block is written as a count of columns (1 byte), then for
+each of them its number (1 byte), the length of its bytes (4 bytes, little
+endian) and the bytes, which continue that column's stream. A block with no
+columns ends the stream.
+*/
+
+#define FIELDS_MAGIC "LZWF"        //the first bytes of a field stream
+#define FIELDS_VERSION (1)         //the format version after the magic
+#define FIELDS_MAXCOLUMNS (16)     //columns with their own string table
+
+// -----------------------------------------------------------------------------
+// void fieldsEncode
+// -----------------------------------------------------------------------------
+// Description:
+//   compresses delimited records in field mode, and writes the result to
+//   stdout. Each column's string table is only allocated when the column is
+//   first used.
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the encoding
+//                  parameters used for every column, the delimiter and the
+//                  record separator
+//   ByteSource in - the function supplying the bytes to compress
+//   void* ctx - the context pointer for in
+
+void fieldsEncode(Options* opt, ByteSource in, void* ctx);
+
+// -----------------------------------------------------------------------------
+// void fieldsDecode
+// -----------------------------------------------------------------------------
+// Description:
+//   decompresses a field stream whose magic has already been read, and writes
+//   the records to stdout
+// Parameters:
+//   Options* opt - a pointer to an options struct. Streams needing more than
+//                  maxmemory are refused, and if scan is set the stream is
+//                  only checked, and its decompressed length printed.
+//   FILE* in - the field stream
+
+void fieldsDecode(Options* opt, FILE* in);
@@ -0,0 +1,474 @@
+/*
+filter.c
+contains implementation code for reversible pre-filters
+*/
+
+#include "globals.h"
+#include "bitio.h"
+#include "encode.h"
+#include "decode.h"
+#include "budget.h"
+#include "filter.h"
+
+#define FILTER_BLOCKSIZE (1 << 20)   //bytes filtered at a time
+
+#define FILTER_DELTA (1)             //the filter types stored in the header
+#define FILTER_SHUFFLE (2)
+#define FILTER_MTF (3)
+
+// -----------------------------------------------------------------------------
+// struct filter
+// -----------------------------------------------------------------------------
+// Description:
+//   one filter of a chain, with the state it carries between blocks
+// Fields:
+//   int type - FILTER_DELTA, FILTER_SHUFFLE or FILTER_MTF
+//   int param - the stride of delta or the element width of shuffle
+//   unsigned char hist[] - for delta, the last param unfiltered bytes
+//   unsigned char list[] - for mtf, the bytes in order of recent use
+
+struct filter{
+  int type;
+  int param;
+  unsigned char hist[UCHAR_MAX + 1];
+  unsigned char list[UCHAR_MAX + 1];
+};
+
+// -----------------------------------------------------------------------------
+// struct filterchain
+// -----------------------------------------------------------------------------
+// Fields:
+//   int count - the number of filters
+//   struct filter f[] - the filters, in the order they are applied
+//   unsigned char* tmp - a buffer of FILTER_BLOCKSIZE bytes for the filters
+//                        to write into
+
+struct filterchain{
+  int count;
+  struct filter f[FILTER_MAX];
+  unsigned char* tmp;
+};
+
+// -----------------------------------------------------------------------------
+// int filterAdd
+// -----------------------------------------------------------------------------
+// Description:
+//   adds a filter to the end of a chain, with its initial state
+// Parameters:
+//   FilterChain fc - the chain
+//   int type - the filter type
+//   int param - the filter parameter
+// Return value:
+//   0 if the filter is valid, -1 otherwise
+
+static int filterAdd(FilterChain fc, int type, int param){
+  struct filter* f = &fc->f[fc->count];
+  int i;
+
+  if(fc->count == FILTER_MAX) return -1;
+  if(type == FILTER_DELTA && (param < 1 || param > UCHAR_MAX)) return -1;
+  if(type == FILTER_SHUFFLE && (param < 2 || param > UCHAR_MAX)) return -1;
+  if(type == FILTER_MTF && param != 0) return -1;
+  if(type < FILTER_DELTA || type > FILTER_MTF) return -1;
+
+  f->type = type;
+  f->param = param;
+  memset(f->hist, 0, sizeof(f->hist));
+  for(i = 0; i <= UCHAR_MAX; i++){
+    f->list[i] = i;
+  }
+  fc->count++;
+
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FilterChain chainCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   creates an empty chain of filters
+
+static FilterChain chainCreate(void){
+  FilterChain fc = malloc(sizeof(*fc));
+
+  fc->count = 0;
+  fc->tmp = malloc(FILTER_BLOCKSIZE);
+
+  return fc;
+}
+
+FilterChain filterChainParse(const char* spec){
+  FilterChain fc = chainCreate();
+  const char* p = spec;
+  char* end;
+  long param;
+  int type;
+
+  for(;;){
+    param = 0;
+    if(!strncmp(p, "delta:", 6)){
+      type = FILTER_DELTA;
+      param = strtol(p + 6, &end, 10);
+    }
+    else if(!strncmp(p, "shuffle:", 8)){
+      type = FILTER_SHUFFLE;
+      param = strtol(p + 8, &end, 10);
+    }
+    else if(!strncmp(p, "mtf", 3)){
+      type = FILTER_MTF;
+      end = (char*)p + 3;
+    }
+    else{
+      break;
+    }
+
+    if((*end != ',' && *end != '\0') || filterAdd(fc, type, param) != 0){
+      break;
+    }
+    if(*end == '\0') return fc;
+    p = end + 1;
+  }
+
+  filterChainDestroy(fc);
+  return 0;
+}
+
+void filterChainDestroy(FilterChain fc){
+  free(fc->tmp);
+  free(fc);
+}
+
+// -----------------------------------------------------------------------------
+// void deltaForward, deltaInverse
+// -----------------------------------------------------------------------------
+// Description:
+//   apply and undo the delta filter on a block. Each output byte depends only
+//   on input bytes, so the main loop of deltaForward vectorizes.
+// Parameters:
+//   struct filter* f - the filter
+//   const unsigned char* src - the block
+//   unsigned char* dst - where the result is written
+//   size_t n - the number of bytes in the block
+
+static void deltaForward(struct filter* f, const unsigned char* src,
+                         unsigned char* dst, size_t n){
+  size_t k = f->param, i;
+
+  for(i = 0; i < k && i < n; i++){
+    dst[i] = src[i] - f->hist[i];
+  }
+  for(; i < n; i++){
+    dst[i] = src[i] - src[i - k];
+  }
+
+  //keep the last k input bytes for the next block
+  if(n >= k){
+    memcpy(f->hist, src + n - k, k);
+  }
+  else{
+    memmove(f->hist, f->hist + n, k - n);
+    memcpy(f->hist + k - n, src, n);
+  }
+}
+
+static void deltaInverse(struct filter* f, const unsigned char* src,
+                         unsigned char* dst, size_t n){
+  size_t k = f->param, i;
+
+  for(i = 0; i < k && i < n; i++){
+    dst[i] = src[i] + f->hist[i];
+  }
+  for(; i < n; i++){
+    dst[i] = src[i] + dst[i - k];
+  }
+
+  if(n >= k){
+    memcpy(f->hist, dst + n - k, k);
+  }
+  else{
+    memmove(f->hist, f->hist + n, k - n);
+    memcpy(f->hist + k - n, dst, n);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// void shuffleForward, shuffleInverse
+// -----------------------------------------------------------------------------
+// Description:
+//   apply and undo the byte plane split on a block. Bytes after the last
+//   whole element are left where they are.
+// Parameters:
+//   the same as deltaForward
+
+static void shuffleForward(struct filter* f, const unsigned char* src,
+                           unsigned char* dst, size_t n){
+  size_t w = f->param, m = n / w, e, p;
+
+  for(p = 0; p < w; p++){
+    for(e = 0; e < m; e++){
+      dst[p * m + e] = src[e * w + p];
+    }
+  }
+  memcpy(dst + m * w, src + m * w, n - m * w);
+}
+
+static void shuffleInverse(struct filter* f, const unsigned char* src,
+                           unsigned char* dst, size_t n){
+  size_t w = f->param, m = n / w, e, p;
+
+  for(p = 0; p < w; p++){
+    for(e = 0; e < m; e++){
+      dst[e * w + p] = src[p * m + e];
+    }
+  }
+  memcpy(dst + m * w, src + m * w, n - m * w);
+}
+
+// -----------------------------------------------------------------------------
+// void mtfForward, mtfInverse
+// -----------------------------------------------------------------------------
+// Description:
+//   apply and undo move-to-front coding on a block
+// Parameters:
+//   the same as deltaForward
+
+static void mtfForward(struct filter* f, const unsigned char* src,
+                       unsigned char* dst, size_t n){
+  unsigned char* list = f->list;
+  unsigned char c;
+  size_t i;
+  int j;
+
+  for(i = 0; i < n; i++){
+    c = src[i];
+    for(j = 0; list[j] != c; j++);
+    dst[i] = j;
+    memmove(list + 1, list, j);
+    list[0] = c;
+  }
+}
+
+static void mtfInverse(struct filter* f, const unsigned char* src,
+                       unsigned char* dst, size_t n){
+  unsigned char* list = f->list;
+  unsigned char c;
+  size_t i;
+  int j;
+
+  for(i = 0; i < n; i++){
+    j = src[i];
+    c = list[j];
+    dst[i] = c;
+    memmove(list + 1, list, j);
+    list[0] = c;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// unsigned char* chainForward, chainInverse
+// -----------------------------------------------------------------------------
+// Description:
+//   apply all the filters of a chain to a block, or undo them in reverse
+//   order. The filters write alternately into the block and the chain's
+//   buffer.
+// Parameters:
+//   FilterChain fc - the chain
+//   unsigned char* buf - the block, which may be overwritten
+//   size_t n - the number of bytes in the block, at most FILTER_BLOCKSIZE
+// Return value:
+//   the result, either buf or the chain's buffer
+
+static unsigned char* chainForward(FilterChain fc, unsigned char* buf,
+                                   size_t n){
+  unsigned char *src = buf, *dst = fc->tmp, *t;
+  struct filter* f;
+  int i;
+
+  for(i = 0; i < fc->count; i++){
+    f = &fc->f[i];
+    switch(f->type){
+      case FILTER_DELTA: deltaForward(f, src, dst, n); break;
+      case FILTER_SHUFFLE: shuffleForward(f, src, dst, n); break;
+      case FILTER_MTF: mtfForward(f, src, dst, n); break;
+    }
+    t = src; src = dst; dst = t;
+  }
+
+  return src;
+}
+
+static unsigned char* chainInverse(FilterChain fc, unsigned char* buf,
+                                   size_t n){
+  unsigned char *src = buf, *dst = fc->tmp, *t;
+  struct filter* f;
+  int i;
+
+  for(i = fc->count - 1; i >= 0; i--){
+    f = &fc->f[i];
+    switch(f->type){
+      case FILTER_DELTA: deltaInverse(f, src, dst, n); break;
+      case FILTER_SHUFFLE: shuffleInverse(f, src, dst, n); break;
+      case FILTER_MTF: mtfInverse(f, src, dst, n); break;
+    }
+    t = src; src = dst; dst = t;
+  }
+
+  return src;
+}
+
+void filterEncode(Options* opt, ByteSource in, void* ctx){
+  FilterChain fc = filterChainParse(opt->filter);
+  unsigned char* buf = malloc(FILTER_BLOCKSIZE);
+  BitWriter out;
+  Encoder enc;
+  size_t n, got;
+  int i;
+
+  fputs(FILTER_MAGIC, stdout);
+  putchar(FILTER_VERSION);
+  writeNumber(stdout, FILTER_BLOCKSIZE, 4);
+  putchar(fc->count);
+  for(i = 0; i < fc->count; i++){
+    putchar(fc->f[i].type);
+    putchar(fc->f[i].param);
+  }
+
+  out = bitWriterCreate(fileSink, stdout);
+  enc = encoderCreate(opt, out);
+
+  //only the last block may be short, so fill each one completely
+  do{
+    for(n = 0; n < FILTER_BLOCKSIZE
+               && (got = in(ctx, buf + n, FILTER_BLOCKSIZE - n)) > 0; n += got);
+    encoderWrite(enc, chainForward(fc, buf, n), n);
+  } while(n == FILTER_BLOCKSIZE);
+  encoderFinish(enc);
+
+  if(opt->stats){
+    EncoderStats stats;
+    encoderStats(enc, &stats);
+    printEncoderStats(stderr, &stats);
+  }
+
+  encoderDestroy(enc);
+  bitWriterDestroy(out);
+  filterChainDestroy(fc);
+  free(buf);
+}
+
+// -----------------------------------------------------------------------------
+// struct blocksink
+// -----------------------------------------------------------------------------
+// Description:
+//   the context for blockSink, which collects decompressed bytes into blocks
+//   and writes them to stdout once their filters have been undone
+// Fields:
+//   FilterChain fc - the filters to undo
+//   unsigned char* block - the block being collected
+//   size_t len - the number of bytes in block
+//   size_t size - the block size of the stream
+
+struct blocksink{
+  FilterChain fc;
+  unsigned char* block;
+  size_t len;
+  size_t size;
+};
+
+// -----------------------------------------------------------------------------
+// void writeBlock
+// -----------------------------------------------------------------------------
+// Description:
+//   undoes the filters of the collected block and writes it out
+// Parameters:
+//   struct blocksink* bs - the collected block
+
+static void writeBlock(struct blocksink* bs){
+  if(fwrite(chainInverse(bs->fc, bs->block, bs->len), 1, bs->len, stdout)
+     != bs->len){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+  bs->len = 0;
+}
+
+static size_t blockSink(void* ctx, const unsigned char* buf, size_t n){
+  struct blocksink* bs = ctx;
+  size_t i = 0, take;
+
+  while(i < n){
+    take = bs->size - bs->len < n - i ? bs->size - bs->len : n - i;
+    memcpy(bs->block + bs->len, buf + i, take);
+    bs->len += take;
+    i += take;
+    if(bs->len == bs->size) writeBlock(bs);
+  }
+
+  return n;
+}
+
+void filterDecode(Options* opt, FILE* in){
+  FilterChain fc = chainCreate();
+  struct blocksink bs = {.fc = fc, .len = 0};
+  Options streamopt = {.maxbits = 0};
+  uint64_t size, produced, position;
+  BitReader br;
+  BitWriter out = 0;
+  Decoder dec;
+  int count, type, param, i, status;
+
+  if(getc(in) != FILTER_VERSION || readNumber(in, &size, 4) != 0
+     || size == 0 || size > FILTER_BLOCKSIZE
+     || (count = getc(in)) == EOF || count > FILTER_MAX){
+    fprintf(stderr, "Error: input file corrupted at byte 4\n");
+    exit(EXIT_FAILURE);
+  }
+  for(i = 0; i < count; i++){
+    if((type = getc(in)) == EOF || (param = getc(in)) == EOF
+       || filterAdd(fc, type, param) != 0){
+      fprintf(stderr, "Error: input file corrupted at byte %d\n", 10 + 2 * i);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  br = bitReaderCreate(fileSource, in);
+  if(decoderReadHeader(br, &streamopt) != 0){
+    fprintf(stderr, "Error: input file corrupted at byte %d\n", 10 + 2 * i);
+    exit(EXIT_FAILURE);
+  }
+  if(opt->maxmemory && memoryFootprint(&streamopt) > opt->maxmemory){
+    fprintf(stderr, "Error: stream needs %" PRIu64 " bytes of memory, "
+            "more than --max-memory allows.\n", memoryFootprint(&streamopt));
+    exit(EXIT_FAILURE);
+  }
+
+  if(!opt->scan){
+    bs.size = size;
+    bs.block = malloc(size);
+    out = bitWriterCreate(blockSink, &bs);
+  }
+  dec = decoderCreate(&streamopt, br, out);
+
+  while((status = decoderRun(dec)) == DECODE_SYNC);
+  decoderProgress(dec, &produced, &position);
+  if(status == DECODE_CORRUPT){
+    fprintf(stderr, "Error: input file corrupted at bit %" PRIu64
+            " of the compressed stream, after %" PRIu64 " bytes of output\n",
+            position, produced);
+    exit(EXIT_FAILURE);
+  }
+
+  if(out){
+    sendRemainingBits(out);
+    if(bs.len > 0) writeBlock(&bs);
+    bitWriterDestroy(out);
+    free(bs.block);
+  }
+  if(opt->scan){
+    printf("%" PRIu64 "\n", produced);
+  }
+
+  decoderDestroy(dec);
+  bitReaderDestroy(br);
+  filterChainDestroy(fc);
+}
@@ -0,0 +1,79 @@
+/*
+filter.h
+contains declarations for reversible pre-filters, which transform the input
+before it is compressed so that LZW finds more repeated strings in it, and
+are undone after it is decompressed
+
+The filters are given as a comma separated list, applied in order:
+
+  delta:N     replaces each byte by its difference from the byte N before it
+              (1 <= N <= 255), which turns slowly changing fixed-width
+              samples into runs of small values
+  shuffle:N   splits each block into byte planes: the first byte of every
+              N-byte element, then the second byte, and so on (2 <= N <= 255)
+  mtf         replaces each byte by its position in a list of recently seen
+              bytes, and moves it to the front of the list
+
+A filtered stream starts with the magic "LZWP", a version byte, the block
+size (4 bytes, little endian), the number of filters (1 byte) and a type and
+parameter byte for each filter. The compressed stream of the filtered bytes
+follows. The input is filtered in blocks of the block size, the last one
+possibly shorter; delta and mtf carry their state from block to block, and
+shuffle works within each block.
+*/
+
+#define FILTER_MAGIC "LZWP"       //the first bytes of a filtered stream
+#define FILTER_VERSION (1)        //the format version after the magic
+#define FILTER_MAX (8)            //the most filters in a chain
+
+typedef struct filterchain *FilterChain;
+
+// -----------------------------------------------------------------------------
+// FilterChain filterChainParse
+// -----------------------------------------------------------------------------
+// Description:
+//   creates a chain of filters from a comma separated list
+// Parameters:
+//   const char* spec - the list, like "delta:4,shuffle:4"
+// Return value:
+//   a new FilterChain, or a null pointer if the list is invalid
+
+FilterChain filterChainParse(const char* spec);
+
+// -----------------------------------------------------------------------------
+// void filterChainDestroy
+// -----------------------------------------------------------------------------
+// Description:
+//   frees a FilterChain
+// Parameters:
+//   FilterChain fc - the FilterChain to destroy
+
+void filterChainDestroy(FilterChain fc);
+
+// -----------------------------------------------------------------------------
+// void filterEncode
+// -----------------------------------------------------------------------------
+// Description:
+//   filters the input, compresses it, and writes the filtered stream to
+//   stdout
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the encoding
+//                  parameters and the filter list
+//   ByteSource in - the function supplying the bytes to compress
+//   void* ctx - the context pointer for in
+
+void filterEncode(Options* opt, ByteSource in, void* ctx);
+
+// -----------------------------------------------------------------------------
+// void filterDecode
+// -----------------------------------------------------------------------------
+// Description:
+//   decompresses a filtered stream whose magic has already been read, undoes
+//   the filters, and writes the result to stdout
+// Parameters:
+//   Options* opt - a pointer to an options struct. Streams needing more than
+//                  maxmemory are refused, and if scan is set the stream is
+//                  only checked, and its decompressed length printed.
+//   FILE* in - the filtered stream
+
+void filterDecode(Options* opt, FILE* in);
@@ -6,10 +6,44 @@ in the LZW project
 by Geoffrey Litt
 */
 
+#include "globals.h"
+
+#ifdef HAVE_SDT
+//the semaphores of the probes in probes.h, raised by attached tracers
+#define SEMAPHORE __attribute__((unused, section(".probes")))
+unsigned short lzw_prune_start_semaphore SEMAPHORE;
+unsigned short lzw_prune_done_semaphore SEMAPHORE;
+unsigned short lzw_table_full_semaphore SEMAPHORE;
+unsigned short lzw_nbits_semaphore SEMAPHORE;
+unsigned short lzw_decode_nbits_semaphore SEMAPHORE;
+unsigned short lzw_escape_semaphore SEMAPHORE;
+unsigned short lzw_flush_semaphore SEMAPHORE;
+#endif
+
 int bitsToRepresent(int codemax){
   int n = 0;
 
-  while((1 << ++n) < codemax);
+  //shift a 64 bit one, so codes past 2^30 don't overflow
+  while(((uint64_t)1 << ++n) < (uint64_t)codemax);
 
   return n;
-}
\ No newline at end of file
+}
+
+void writeNumber(FILE* f, uint64_t n, int bytes){
+  while(bytes-- > 0){
+    putc(n & 0xFF, f);
+    n >>= CHAR_BIT;
+  }
+}
+
+int readNumber(FILE* f, uint64_t* n, int bytes){
+  int i, c;
+
+  *n = 0;
+  for(i = 0; i < bytes; i++){
+    if((c = getc(f)) == EOF) return -1;
+    *n |= (uint64_t)c << (CHAR_BIT * i);
+  }
+
+  return 0;
+}
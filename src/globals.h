@@ -19,6 +19,9 @@ by Geoffrey Litt
 #define ESCAPE (1)                //escape
 #define PRUNE (2)                 //prune the table
 #define INCR_NBITS (3)            //increment nbits
+#define SYNC (EMPTY)              //sync point: the rest of the byte is padding
+                                  //and the next code starts a new string
+                                  //(EMPTY itself is never sent as a code)
 
                                   //the number of bits at the beginning of the
                                   //encoded file used to signify:
@@ -26,6 +29,18 @@ by Geoffrey Litt
 #define BITS_TO_SEND_WINDOW (24)  //window
 #define BITS_TO_SEND_ESCAPE (1)   //escape
 
+                                  //the extended header, used when maxbits or
+                                  //window don't fit in the original fields:
+#define HEADER_EXTENDED (0x80)    //flag or'd into the maxbits field
+#define BITS_TO_SEND_WINDOW_EXT (48) //window, sent as two 24 bit halves
+
+#define MIN_MAXBITS (CHAR_BIT + 1)   //smallest legal maxbits
+#define LEGACY_MAXBITS (24)          //largest maxbits in the original header
+#define MAX_MAXBITS (30)             //largest maxbits supported
+#define DEFAULT_MAXBITS (12)         //maxbits used if none is given
+
+#define LONGMATCH_HISTORY (1 << 22)  //input bytes kept for --long-match
+
 
 // -----------------------------------------------------------------------------
 // struct options
@@ -35,14 +50,69 @@ by Geoffrey Litt
 // Fields:
 //   int decode - 0 if the program should encode, 1 if it should decode
 //   int maxbits - the maxbits value set by the user
-//   int prune - the window value set by the user
+//   int64_t prune - the window value set by the user
 //   int escape - 0 if the -e flag is not set, 1 if the -e flag is set
+//   uint64_t maxmemory - the --max-memory budget in bytes, 0 if unlimited
+//   int dryrun - 1 if the parameters should be printed instead of encoding
+//   int autotune - 1 if the parameters should be picked by sampling the input
+//   double autoweight - for autotune, how much speed counts against size (0-1)
+//   char* checkpoint - file to save the encoder state to at the end, or null
+//   char* resume - checkpoint file to restore the encoder state from, or null
+//   int flushms - flush the stream when input has waited this long, 0 if never
+//   int flushnewline - 1 if the stream should be flushed after each newline
+//   int verify - 1 if the stream should be decoded and checked as it is written
+//   int scan - 1 if decode should only check the stream and print its length
+//   int stats - 1 if encode should print statistics to stderr at the end
+//   int longmatch - 1 if the encoder should use the long match fast path
+//   int best - 1 if the encoder should parse flexibly for the smallest output
+//   char* socket - for lzwd, the path of the socket to listen on, else null
+//   int threads - the number of threads for lzwd and archives, 0 for one per
+//                 processor
+//   int queue - for lzwd, how many connections may wait for a worker
+//   int archive - 1 if encode should write an archive of the paths
+//   char* filelist - a file listing more paths to archive, "-" for stdin
+//   int list - 1 if decode should list the members of an archive
+//   char** paths - the paths to archive, or the archive members to extract
+//   int npaths - the number of paths
+//   int fields - 1 if each column of delimited records gets its own table
+//   int delimiter - the byte between fields, for fields
+//   int separator - the byte between records, for fields
+//   char* filter - the pre-filters to apply before compressing, or null
+//   int dedup - 1 if repeated chunks of the input should be stored only once
+//   int lanes - the number of streams decoded together, 0 for a single one
 
 typedef struct options{
   int decode;
   int maxbits;
-  int prune;
+  int64_t prune;
   int escape;
+  uint64_t maxmemory;
+  int dryrun;
+  int autotune;
+  double autoweight;
+  char* checkpoint;
+  char* resume;
+  int flushms;
+  int flushnewline;
+  int verify;
+  int scan;
+  int stats;
+  int longmatch;
+  int best;
+  char* socket;
+  int threads;
+  int queue;
+  int archive;
+  char* filelist;
+  int list;
+  char** paths;
+  int npaths;
+  int fields;
+  int delimiter;
+  int separator;
+  char* filter;
+  int dedup;
+  int lanes;
 } Options;
 
 // -----------------------------------------------------------------------------
@@ -55,4 +125,30 @@ typedef struct options{
 // Return value:
 //   the minimum number of bits necessary to represent the value codemax
 
-int bitsToRepresent(int codemax);
\ No newline at end of file
+int bitsToRepresent(int codemax);
+
+// -----------------------------------------------------------------------------
+// void writeNumber
+// -----------------------------------------------------------------------------
+// Description:
+//   writes an unsigned number to a file in little endian byte order
+// Parameters:
+//   FILE* f - the file to write to
+//   uint64_t n - the number to write
+//   int bytes - the number of bytes to write it in
+
+void writeNumber(FILE* f, uint64_t n, int bytes);
+
+// -----------------------------------------------------------------------------
+// int readNumber
+// -----------------------------------------------------------------------------
+// Description:
+//   reads an unsigned number written by writeNumber
+// Parameters:
+//   FILE* f - the file to read from
+//   uint64_t* n - where the number is stored
+//   int bytes - the number of bytes it was written in
+// Return value:
+//   0 if the number was read, -1 if the file ended first
+
+int readNumber(FILE* f, uint64_t* n, int bytes);
@@ -11,9 +11,20 @@ string tables used in the encoder and decoder act in the same way.
 by Geoffrey Litt
 */
 
+#define _GNU_SOURCE
 #include "globals.h"
 #include "hasharray.h"
 #include "stack.h"
+#include "probes.h"
+#include <sys/mman.h>
+
+//tables at least this large are mmap'd and backed by huge pages if possible
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+//tables of at least HOT_MINSIZE entries have a hot index of HOT_SLOTS slots
+#define HOT_BITS (14)
+#define HOT_SLOTS (1 << HOT_BITS)
+#define HOT_MINSIZE (1 << 16)
 
 // -----------------------------------------------------------------------------
 // struct hasharray
@@ -23,55 +34,153 @@ by Geoffrey Litt
 // Fields:
 //   int size - the maximum number of elements that can fit in the hash array
 //   int elts - the number of elements currently stored in the hash array
-//   struct elt **hashtable - a hash table data structure
-//   struct elt **array - an array data structure
+//   size_t hashsize - the number of slots in the hash table
+//   uint32_t *hashtable - a hash table of codes, 0 marks an empty slot
+//                         (the special codes are never stored in it)
+//   struct elt *array - an array of all the entries, indexed by code
+//   uint64_t *hot - a direct-mapped cache of the entries found by
+//                   HashArrayCharPrefixLookup, small enough to stay in the
+//                   CPU cache, or null for tables small enough themselves.
+//                   Each slot holds a prefix in its top 32 bits and a code in
+//                   the rest, 0 when it is empty.
+//   uint64_t lookups - the number of lookups made through hot
+//   uint64_t hits - the number of them answered by hot
 
 struct hasharray{
   int size;
   int elts;
-  struct elt **hashtable;
-  struct elt **array;
+  size_t hashsize;
+  uint32_t *hashtable;
+  struct elt *array;
+  uint64_t *hot;
+  uint64_t lookups;
+  uint64_t hits;
 };
 
 // -----------------------------------------------------------------------------
-// int hash
+// size_t hash
 // -----------------------------------------------------------------------------
 // Description:
 //   a hash function used to compute indices for a hash table
+//   the key is mixed with a multiplicative (Fibonacci) hash, so that every bit
+//   of the prefix affects the index whatever the size of the table
 // Parameters:
 //   int prefix - the prefix of the triple being stored
 //   int kar - the char of the triple being stored
-//   int size - the size of the hash table
+//   size_t size - the size of the hash table
 // Return value:
 //   the index that should be used to store the triplet
 
-int hash(int prefix, int kar, int size){
-  int i;
-  i = ((unsigned int)(prefix) << CHAR_BIT | (unsigned int)(kar)) % size;
-  return i;
+static size_t hash(int prefix, int kar, size_t size){
+  uint64_t key = (uint64_t)(unsigned int)prefix << CHAR_BIT
+                 | (unsigned char)kar;
+  return ((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) * size >> 32;
 }
 
-HashArray HashArrayCreate(int size, int escape){
-  HashArray ha;
-  int i;
+// -----------------------------------------------------------------------------
+// size_t hotIndex
+// -----------------------------------------------------------------------------
+// Description:
+//   computes the slot of the hot index for a prefix and char. The char is
+//   added to a hash of the prefix, so for a given prefix each char has its
+//   own slot, and a slot whose prefix matches also matches the char.
+// Parameters:
+//   int prefix - the prefix looked up
+//   int kar - the char looked up
+// Return value:
+//   the slot to use
 
-  ha = malloc(sizeof(*ha));
+static size_t hotIndex(int prefix, int kar){
+  uint32_t mix = (uint32_t)prefix * UINT32_C(0x9E3779B1);
+  return ((mix >> (32 - HOT_BITS)) + (unsigned char)kar) & (HOT_SLOTS - 1);
+}
 
-  ha->size = size;
-  ha->elts = 0;
+// -----------------------------------------------------------------------------
+// size_t tableBytes
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the number of bytes tableAlloc really allocates for a request
+// Parameters:
+//   size_t bytes - the number of bytes requested from tableAlloc
+// Return value:
+//   the requested size, rounded up to whole huge pages if it is mapped
 
-  //allocate hashtable memory
-  //2*max number of elements for performance
-  //+1 to improve hash function performance
-  ha->hashtable = calloc((2 * size) + 1, sizeof(struct elt *));
+static size_t tableBytes(size_t bytes){
+  if(bytes < HUGE_PAGE_SIZE) return bytes;
+  return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
 
-  //allocate array memory
-  //simply the max number of elements for performance
-  ha->array = calloc(size, sizeof(struct elt *));
+// -----------------------------------------------------------------------------
+// void* tableAlloc
+// -----------------------------------------------------------------------------
+// Description:
+//   allocates zeroed memory for one of the tables of a hash array
+//   large tables are mapped directly, using explicit huge pages if any are
+//   reserved and transparent huge pages otherwise
+// Parameters:
+//   size_t bytes - the number of bytes to allocate
+// Return value:
+//   a pointer to the memory, or a null pointer if it can't be allocated
+
+static void *tableAlloc(size_t bytes){
+  void *p;
+
+  if(bytes < HUGE_PAGE_SIZE){
+    p = calloc(1, bytes);
+  }
+  else{
+    bytes = tableBytes(bytes);
+    p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    p = mmap(0, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if(p == MAP_FAILED){
+      p = mmap(0, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+      if(p != MAP_FAILED) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    if(p == MAP_FAILED) p = 0;
+  }
+
+  return p;
+}
+
+// -----------------------------------------------------------------------------
+// void tableFree
+// -----------------------------------------------------------------------------
+// Description:
+//   frees memory allocated by tableAlloc
+// Parameters:
+//   void *p - the memory to free
+//   size_t bytes - the number of bytes that were passed to tableAlloc
+
+static void tableFree(void *p, size_t bytes){
+  if(bytes < HUGE_PAGE_SIZE){
+    free(p);
+  }
+  else{
+    munmap(p, tableBytes(bytes));
+  }
+}
+
+// -----------------------------------------------------------------------------
+// void populate
+// -----------------------------------------------------------------------------
+// Description:
+//   adds the initial entries to an empty HashArray
+// Parameters:
+//   HashArray ha - the HashArray to populate
+//   int escape - the value of the escape flag (0 or 1)
+
+static void populate(HashArray ha, int escape){
+  int i;
 
   //reserve the 4 special codes
   //use -1 as kar to avoid finding these entries otherwise
-  for(i = 0; i < 4; i++){
+  for(i = 0; i < NUM_SPECIALS; i++){
     HashArrayInsert(ha, -1, 0);
   }
 
@@ -81,19 +190,105 @@ HashArray HashArrayCreate(int size, int escape){
       HashArrayInsert(ha, i, 0);
     }
   }
+}
+
+HashArray HashArrayCreate(int size, int escape){
+  HashArray ha = HashArrayTryCreate(size, escape);
+
+  if(ha == 0){
+    fprintf(stderr, "Error: could not allocate %zu bytes for string table\n",
+            HashArrayFootprint(size));
+    exit(EXIT_FAILURE);
+  }
 
   return ha;
 }
 
-void HashArrayDestroy(HashArray ha){
-  int i;
+HashArray HashArrayTryCreate(int size, int escape){
+  HashArray ha;
+
+  ha = malloc(sizeof(*ha));
+
+  ha->size = size;
+  ha->elts = 0;
+
+  //allocate hashtable memory
+  //2*max number of elements for performance
+  ha->hashsize = (2 * (size_t)size) + 1;
+  ha->hashtable = tableAlloc(ha->hashsize * sizeof(*ha->hashtable));
 
-  for(i = 0; i < ha->size; i++){
-    if(ha->array[i] != NULL) free(ha->array[i]);
+  //allocate array memory
+  //simply the max number of elements, entries live directly in the array
+  ha->array = tableAlloc((size_t)size * sizeof(*ha->array));
+
+  //the hot index only pays off when the rest doesn't fit in the CPU cache
+  ha->hot = size >= HOT_MINSIZE ? calloc(HOT_SLOTS, sizeof(*ha->hot)) : 0;
+  ha->lookups = 0;
+  ha->hits = 0;
+
+  if(ha->hashtable == 0 || ha->array == 0
+     || (size >= HOT_MINSIZE && ha->hot == 0)){
+    if(ha->hashtable) tableFree(ha->hashtable,
+                                ha->hashsize * sizeof(*ha->hashtable));
+    if(ha->array) tableFree(ha->array, (size_t)size * sizeof(*ha->array));
+    free(ha->hot);
+    free(ha);
+    return 0;
   }
 
-  free(ha->hashtable);
-  free(ha->array);
+  populate(ha, escape);
+
+  return ha;
+}
+
+void HashArrayReset(HashArray ha, int escape){
+  struct elt* e;
+  size_t i;
+  int code;
+
+  if((size_t)ha->elts > ha->hashsize / 16){
+    memset(ha->hashtable, 0, ha->hashsize * sizeof(*ha->hashtable));
+  }
+  else{
+    //find each entry's slot, not stopping at slots already cleared
+    for(code = NUM_SPECIALS; code < ha->elts; code++){
+      e = &ha->array[code];
+      i = hash(e->prefix, e->kar, ha->hashsize);
+      while(ha->hashtable[i] != (uint32_t)code){
+        if(++i == ha->hashsize) i = 0;
+      }
+      ha->hashtable[i] = 0;
+    }
+  }
+
+  if(ha->hot) memset(ha->hot, 0, HOT_SLOTS * sizeof(*ha->hot));
+  ha->lookups = 0;
+  ha->hits = 0;
+
+  ha->elts = 0;
+  populate(ha, escape);
+}
+
+int HashArraySize(HashArray ha){
+  return ha->size;
+}
+
+void HashArrayHotStats(HashArray ha, uint64_t* lookups, uint64_t* hits){
+  *lookups = ha->lookups;
+  *hits = ha->hits;
+}
+
+size_t HashArrayFootprint(int size){
+  return sizeof(struct hasharray)
+         + tableBytes(((2 * (size_t)size) + 1) * sizeof(uint32_t))
+         + tableBytes((size_t)size * sizeof(struct elt))
+         + (size >= HOT_MINSIZE ? HOT_SLOTS * sizeof(uint64_t) : 0);
+}
+
+void HashArrayDestroy(HashArray ha){
+  tableFree(ha->hashtable, ha->hashsize * sizeof(*ha->hashtable));
+  tableFree(ha->array, (size_t)ha->size * sizeof(*ha->array));
+  free(ha->hot);
   free(ha);
 }
 
@@ -105,58 +300,97 @@ void HashArrayInsert(HashArray ha, int kar, int prefix){
   }
 
   struct elt *e;
-  int i;
+  size_t i;
   int code = ha->elts;
 
-  e = malloc(sizeof(*e));
+  e = &ha->array[code];
 
   e->code = code;
   e->kar = kar;
   e->prefix = prefix;
   e->time = 0;
 
-  //insert into hashtable first
-  i = hash(prefix, kar, ha->size);
-  //keep incrementing the index if something is already there
-  while(ha->hashtable[i] != NULL) i++;
-  //when we find an empty spot, insert there
-  ha->hashtable[i] = e;
-
-  //then insert into the array -- pretty straightforward
-  if(ha->array[code] == NULL){
-    ha->array[code] = e;
+  //the length and first char follow from the prefix's
+  if(code < NUM_SPECIALS){
+    e->len = 0;
+    e->first = 0;
+  }
+  else if(prefix == EMPTY){
+    e->len = 1;
+    e->first = kar;
   }
   else{
-    fprintf(stderr, "code double counted!\n");
+    e->len = ha->array[prefix].len + 1;
+    e->first = ha->array[prefix].first;
+  }
+
+  //insert into hashtable, unless this is one of the special codes
+  if(code >= NUM_SPECIALS){
+    i = hash(prefix, kar, ha->hashsize);
+    //keep incrementing the index if something is already there
+    while(ha->hashtable[i] != 0){
+      if(++i == ha->hashsize) i = 0;
+    }
+    //when we find an empty spot, insert there
+    ha->hashtable[i] = code;
   }
 
   //increment the hasharray's counter for number of elements
-  ha->elts++;
+  if(++ha->elts == ha->size) PROBE1(table_full, ha->size);
 }
 
-struct elt* HashArrayCharPrefixLookup(HashArray ha, int kar, int prefix){
+void HashArrayPrefetch(HashArray ha, int kar, int prefix){
+  __builtin_prefetch(&ha->hashtable[hash(prefix, kar, ha->hashsize)], 1);
+}
+
+int HashArrayCharPrefixCode(HashArray ha, int kar, int prefix){
   struct elt *e;
-  int i;
-  i = hash(prefix, kar, ha->size);
+  uint64_t *slot = 0;
+  uint32_t code;
+  size_t i;
+
+  //try the hot index first, entries are never removed from a table, so a
+  //slot stays right until the table is pruned or reset. A hit doesn't touch
+  //the array at all.
+  if(ha->hot){
+    slot = &ha->hot[hotIndex(prefix, kar)];
+    ha->lookups++;
+    if((uint32_t)(*slot >> 32) == (uint32_t)prefix && (uint32_t)*slot != 0){
+      ha->hits++;
+      return (uint32_t)*slot;
+    }
+  }
+
+  i = hash(prefix, kar, ha->hashsize);
 
   //look in the hash table, use linear probing
-  while((e = ha->hashtable[i++]) != NULL){
+  while((code = ha->hashtable[i]) != 0){
+    e = &ha->array[code];
     if(e->kar == kar && e->prefix == prefix){
-      return e;
+      if(slot) *slot = (uint64_t)(uint32_t)prefix << 32 | code;
+      return code;
     }
+    if(++i == ha->hashsize) i = 0;
   }
 
-  return 0;
+  return EMPTY;
+}
+
+struct elt* HashArrayCharPrefixLookup(HashArray ha, int kar, int prefix){
+  int code = HashArrayCharPrefixCode(ha, kar, prefix);
+
+  return code != EMPTY ? &ha->array[code] : 0;
 }
 
 struct elt* HashArrayCodeLookup(HashArray ha, int code){
   //if the element exists, the elt* will be returned
   //otherwise a null pointer will be returned
-  return ha->array[code];
+  if(code < 0 || code >= ha->elts) return 0;
+  return &ha->array[code];
 }
 
-void HashArrayUpdateSentTime(HashArray ha, int code, int time){
-  (ha->array[code])->time = time;
+void HashArrayUpdateSentTime(HashArray ha, int code, int64_t time){
+  ha->array[code].time = time;
 }
 
 int HashArrayFreeSpots(HashArray ha){
@@ -167,16 +401,19 @@ int HashArrayElts(HashArray ha){
   return ha->elts;
 }
 
-HashArray HashArrayPrune(HashArray ha, int window, int escape, int curtime){
+HashArray HashArrayPrune(HashArray ha, int64_t window, int escape,
+                         int64_t curtime){
   int i, j;
-  int size = ha->size;
+  int size = ha->size, before = ha->elts;
+  //only read the clock when a tracer is listening for the duration
+  int64_t start = PROBE_ENABLED(prune_done) ? probeNow() : 0;
   struct elt* e;
 
+  PROBE3(prune_start, before, window, curtime);
+
   //create and initialize array mapping old codes to new
-  int newcodes[size];
-  for(i = 0; i < size; i++){
-    newcodes[i] = 0;
-  }
+  //(on the heap, it is far too big for the stack at large maxbits)
+  int *newcodes = calloc(size, sizeof(*newcodes));
   if(!escape){
     for(i = 0; i < (1 << CHAR_BIT); i++){
       j = i + NUM_SPECIALS;
@@ -184,15 +421,17 @@ HashArray HashArrayPrune(HashArray ha, int window, int escape, int curtime){
     }
   }
 
-  int cutofftime = curtime - window;
+  int64_t cutofftime = curtime - window;
   if(cutofftime < 0) cutofftime = 0;
 
   HashArray newha = HashArrayCreate(size, escape);
+  newha->lookups = ha->lookups;
+  newha->hits = ha->hits;
 
   Stack codestack = stackCreate();
 
-  for(i = 0; i < size; i++){
-    e = ha->array[i];
+  for(i = 0; i < ha->elts; i++){
+    e = &ha->array[i];
     if(e->time > cutofftime && newcodes[e->code] == 0){
       //we need to add prefixes starting from beginning of string
       while(e->prefix != EMPTY){
@@ -218,6 +457,46 @@ HashArray HashArrayPrune(HashArray ha, int window, int escape, int curtime){
 
   HashArrayDestroy(ha);
   stackDestroy(codestack);
+  free(newcodes);
+
+  PROBE3(prune_done, before, newha->elts,
+         start && PROBE_ENABLED(prune_done) ? probeNow() - start : 0);
 
   return newha;
 }
+
+void HashArraySave(HashArray ha, FILE* f){
+  int i;
+
+  writeNumber(f, ha->elts, 4);
+  for(i = NUM_SPECIALS; i < ha->elts; i++){
+    writeNumber(f, ha->array[i].kar, 1);
+    writeNumber(f, ha->array[i].prefix, 4);
+    writeNumber(f, ha->array[i].time, 8);
+  }
+}
+
+HashArray HashArrayLoad(FILE* f, int size){
+  uint64_t elts, kar, prefix, time;
+  HashArray ha;
+  int i;
+
+  if(readNumber(f, &elts, 4) || elts < NUM_SPECIALS || elts > (uint64_t)size){
+    return 0;
+  }
+
+  //start from just the special codes, every other entry is in the file
+  ha = HashArrayCreate(size, 1);
+  for(i = NUM_SPECIALS; i < (int)elts; i++){
+    if(readNumber(f, &kar, 1) || readNumber(f, &prefix, 4)
+       || readNumber(f, &time, 8) || prefix >= (uint64_t)i
+       || (prefix != EMPTY && prefix < NUM_SPECIALS)){
+      HashArrayDestroy(ha);
+      return 0;
+    }
+    HashArrayInsert(ha, kar, prefix);
+    HashArrayUpdateSentTime(ha, i, time);
+  }
+
+  return ha;
+}
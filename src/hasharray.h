@@ -22,16 +22,20 @@ typedef struct hasharray *HashArray;
 //   HashArrays return a pointer to a struct elt, which is then dealt with
 //   by an external caller.
 // Fields:
+//   int64_t time - a number representing the last time the code was sent
 //   int code - the numerical code of the string table entry
-//   int kar - the trailing char of the string table entry
 //   int prefix - the code of the prefix of the string table entry
-//   int time - a number representing the last time the code was sent
+//   int len - the length of the entry's string (0 for the special codes)
+//   short kar - the trailing char of the string table entry
+//   unsigned char first - the first char of the entry's string
 
 struct elt{
+  int64_t time;
   int code;
-  int kar;
   int prefix;
-  int time;
+  int len;
+  short kar;
+  unsigned char first;
 };
 
 // -----------------------------------------------------------------------------
@@ -39,6 +43,10 @@ struct elt{
 // -----------------------------------------------------------------------------
 // Description:
 //   creates a new HashArray, allocates the necessary memory
+//   all of the memory is allocated up front, so the footprint of a HashArray
+//   depends only on its size. Large tables are backed by huge pages where the
+//   system allows it, and get a small hot index of recently found entries
+//   which is checked before the hash table.
 // Parameters:
 //   int size - the maximum number of elements that the HashArray should hold
 //   int escape - the value of the escape flag (0 or 1), which determines whether
@@ -48,6 +56,20 @@ struct elt{
 
 HashArray HashArrayCreate(int size, int escape);
 
+// -----------------------------------------------------------------------------
+// HashArray HashArrayTryCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   creates a new HashArray like HashArrayCreate, but returns instead of
+//   exiting the program if its memory can't be allocated
+// Parameters:
+//   int size - the maximum number of elements that the HashArray should hold
+//   int escape - the value of the escape flag (0 or 1)
+// Return value:
+//   an initialized HashArray, or a null pointer if there isn't enough memory
+
+HashArray HashArrayTryCreate(int size, int escape);
+
 // -----------------------------------------------------------------------------
 // void HashArrayDestroy
 // -----------------------------------------------------------------------------
@@ -74,12 +96,27 @@ void HashArrayDestroy(HashArray ha);
 
 void HashArrayInsert(HashArray ha, int kar, int prefix);
 
+// -----------------------------------------------------------------------------
+// void HashArrayPrefetch
+// -----------------------------------------------------------------------------
+// Description:
+//   starts fetching the hash table slot for a char and prefix into the cache,
+//   so that a later insert or lookup of the pair doesn't wait for memory
+// Parameters:
+//   HashArray ha - the HashArray the pair will be inserted into or looked up
+//                  in
+//   int kar - the char
+//   int prefix - the prefix
+
+void HashArrayPrefetch(HashArray ha, int kar, int prefix);
+
 // -----------------------------------------------------------------------------
 // struct elt* HashArrayCharPrefixLookup
 // -----------------------------------------------------------------------------
 // Description:
 //   looks up the code matching a char and prefix, using the hash table part
-//   of the data structure for performance
+//   of the data structure for performance. In large tables the hot index is
+//   tried first, and remembers the entry found otherwise.
 // Parameters:
 //   HashArray ha - the HashArray to search in
 //   int kar - the character to search for
@@ -91,6 +128,23 @@ void HashArrayInsert(HashArray ha, int kar, int prefix);
 
 struct elt* HashArrayCharPrefixLookup(HashArray ha, int kar, int prefix);
 
+// -----------------------------------------------------------------------------
+// int HashArrayCharPrefixCode
+// -----------------------------------------------------------------------------
+// Description:
+//   looks up the code matching a char and prefix, like
+//   HashArrayCharPrefixLookup, but only returns the code. When the hot index
+//   has the pair, the entry itself is not read, so the lookup stays in the
+//   CPU cache however large the table is.
+// Parameters:
+//   HashArray ha - the HashArray to search in
+//   int kar - the character to search for
+//   int prefix - the prefix to search for
+// Return value:
+//   the code of the matching entry, or EMPTY if there is none
+
+int HashArrayCharPrefixCode(HashArray ha, int kar, int prefix);
+
 // -----------------------------------------------------------------------------
 // struct elt* HashArrayCodeLookup
 // -----------------------------------------------------------------------------
@@ -115,11 +169,11 @@ struct elt* HashArrayCodeLookup(HashArray ha, int code);
 // Parameters:
 //   HashArray ha - the HashArray to update
 //   int code - the code of the string table entry to update
-//   int time - a number representing the last sent time for the given code
+//   int64_t time - a number representing the last sent time for the given code
 // External state:
 //   modifies an entry in the HashArray passed in
 
-void HashArrayUpdateSentTime(HashArray ha, int code, int time);
+void HashArrayUpdateSentTime(HashArray ha, int code, int64_t time);
 
 // -----------------------------------------------------------------------------
 // int HashArrayFreeSpots
@@ -153,12 +207,91 @@ int HashArrayElts(HashArray ha);
 //   (and all one-character strings, if escape is 0)
 // Parameters:
 //   HashArray ha - the HashArray to prune
-//   int window - the value of WINDOW, i.e. how far back to accept strings
+//   int64_t window - the value of WINDOW, i.e. how far back to accept strings
 //   int escape - 0 or 1, representing whether -e is set. If escape = 1, all the
 //                one character strings are not added to the new table.
-//   int curtime - a number representing the current "time", relative to which
+//   int64_t curtime - a number representing the current "time", relative to which
 //                 the last sent times for the codes will be compared
 // Return value:
 //   Returns a new HashArray which represents the pruned HashArray
 
-HashArray HashArrayPrune(HashArray ha, int window, int escape, int curtime);
+HashArray HashArrayPrune(HashArray ha, int64_t window, int escape,
+                         int64_t curtime);
+
+// -----------------------------------------------------------------------------
+// size_t HashArrayFootprint
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the number of bytes HashArrayCreate allocates for a HashArray
+// Parameters:
+//   int size - the maximum number of elements that the HashArray should hold
+// Return value:
+//   the number of bytes of memory used by a HashArray of the given size
+
+size_t HashArrayFootprint(int size);
+
+// -----------------------------------------------------------------------------
+// void HashArraySave
+// -----------------------------------------------------------------------------
+// Description:
+//   writes every entry of a HashArray to a file, in code order
+// Parameters:
+//   HashArray ha - the HashArray to save
+//   FILE* f - the file to write to
+
+void HashArraySave(HashArray ha, FILE* f);
+
+// -----------------------------------------------------------------------------
+// HashArray HashArrayLoad
+// -----------------------------------------------------------------------------
+// Description:
+//   creates a HashArray holding the entries saved by HashArraySave
+// Parameters:
+//   FILE* f - the file to read from
+//   int size - the maximum number of elements that the HashArray should hold
+// Return value:
+//   the restored HashArray, or a null pointer if the saved entries are corrupt
+
+HashArray HashArrayLoad(FILE* f, int size);
+
+// -----------------------------------------------------------------------------
+// void HashArrayReset
+// -----------------------------------------------------------------------------
+// Description:
+//   empties a HashArray and initializes it again as HashArrayCreate would,
+//   reusing its memory. Only the hash table slots in use are cleared when the
+//   table is sparsely filled, so resetting after a short stream is cheap even
+//   for a large table.
+// Parameters:
+//   HashArray ha - the HashArray to reset
+//   int escape - the value of the escape flag (0 or 1)
+// External state:
+//   modifies the HashArray passed in
+
+void HashArrayReset(HashArray ha, int escape);
+
+// -----------------------------------------------------------------------------
+// int HashArraySize
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the maximum number of entries in a HashArray
+// Parameters:
+//   HashArray ha - the HashArray to examine
+
+int HashArraySize(HashArray ha);
+
+// -----------------------------------------------------------------------------
+// void HashArrayHotStats
+// -----------------------------------------------------------------------------
+// Description:
+//   reports how well the hot index in front of the hash table of a large
+//   HashArray works. The counts carry over when the HashArray is pruned, and
+//   start again when it is reset.
+// Parameters:
+//   HashArray ha - the HashArray to examine
+//   uint64_t* lookups - set to the number of HashArrayCharPrefixLookup calls
+//                       that tried the hot index, 0 if the table has none
+//   uint64_t* hits - set to the number of them it answered
+
+void HashArrayHotStats(HashArray ha, uint64_t* lookups, uint64_t* hits);
+
@@ -0,0 +1,258 @@
+/*
+lanes.c
+contains implementation code for lane mode
+*/
+
+#include "globals.h"
+#include "bitio.h"
+#include "encode.h"
+#include "decode.h"
+#include "budget.h"
+#include "lanes.h"
+
+#define LANES_SEGMENT (1 << 16)   //input bytes given to a lane at a time
+
+// -----------------------------------------------------------------------------
+// struct lane
+// -----------------------------------------------------------------------------
+// Description:
+//   the state of one lane, when encoding or decoding
+// Fields:
+//   Encoder enc - compresses the lane's segments, created for its first one
+//   Decoder dec - decompresses them, created for its first one
+//   BitReader in - reads the compressed bytes of the current segment
+//   BitWriter out - writes the compressed bytes of the current segment to
+//                   buf when encoding, or its decompressed bytes when
+//                   decoding (null to scan)
+//   unsigned char* buf - the bytes written by out
+//   size_t len - the number of bytes in buf
+//   size_t cap - the number of bytes allocated for buf
+//   unsigned char* packed - the compressed bytes of the segment, to decode
+//   size_t packedlen - the number of bytes in packed
+//   size_t packedcap - the number of bytes allocated for packed
+//   size_t pos - the number of bytes of packed already read
+//   uint64_t fed - the number of compressed bytes read so far
+//   uint64_t size - the length of the segment being decoded
+//   uint64_t before - the number of bytes the lane decoded before it
+
+struct lane{
+  Encoder enc;
+  Decoder dec;
+  BitReader in;
+  BitWriter out;
+  unsigned char* buf;
+  size_t len;
+  size_t cap;
+  unsigned char* packed;
+  size_t packedlen;
+  size_t packedcap;
+  size_t pos;
+  uint64_t fed;
+  uint64_t size;
+  uint64_t before;
+};
+
+static size_t laneSink(void* ctx, const unsigned char* buf, size_t n){
+  struct lane* l = ctx;
+
+  if(l->len + n > l->cap){
+    l->cap = l->len + n > 2 * l->cap ? l->len + n : 2 * l->cap;
+    l->buf = realloc(l->buf, l->cap);
+  }
+  memcpy(l->buf + l->len, buf, n);
+  l->len += n;
+
+  return n;
+}
+
+static size_t packedSource(void* ctx, unsigned char* buf, size_t n){
+  struct lane* l = ctx;
+
+  if(n > l->packedlen - l->pos) n = l->packedlen - l->pos;
+  memcpy(buf, l->packed + l->pos, n);
+  l->pos += n;
+  l->fed += n;
+
+  return n;
+}
+
+void lanesEncode(Options* opt, ByteSource in, void* ctx){
+  int nlanes = opt->lanes, k, i;
+  struct lane* lanes = calloc(nlanes, sizeof(*lanes));
+  size_t size = (size_t)nlanes * LANES_SEGMENT, n, got, seglen;
+  unsigned char* data = malloc(size);
+  EncoderStats stats, total;
+
+  memset(&total, 0, sizeof(total));
+  fputs(LANES_MAGIC, stdout);
+  putchar(LANES_VERSION);
+  putchar(nlanes);
+  writeNumber(stdout, LANES_SEGMENT, 4);
+
+  for(;;){
+    for(n = 0; n < size && (got = in(ctx, data + n, size - n)) > 0; n += got);
+    if(n == 0) break;
+
+    //each segment ends at a sync point, so its lane's bytes stand alone
+    k = (n + LANES_SEGMENT - 1) / LANES_SEGMENT;
+    for(i = 0; i < k; i++){
+      if(!lanes[i].enc){
+        lanes[i].out = bitWriterCreate(laneSink, &lanes[i]);
+        lanes[i].enc = encoderCreate(opt, lanes[i].out);
+      }
+      seglen = n - (size_t)i * LANES_SEGMENT;
+      if(seglen > LANES_SEGMENT) seglen = LANES_SEGMENT;
+      encoderWrite(lanes[i].enc, data + (size_t)i * LANES_SEGMENT, seglen);
+      encoderFlush(lanes[i].enc);
+    }
+
+    putchar(k);
+    for(i = 0; i < k; i++){
+      seglen = n - (size_t)i * LANES_SEGMENT;
+      writeNumber(stdout, seglen > LANES_SEGMENT ? LANES_SEGMENT : seglen, 4);
+      writeNumber(stdout, lanes[i].len, 4);
+    }
+    for(i = 0; i < k; i++){
+      fwrite(lanes[i].buf, 1, lanes[i].len, stdout);
+      lanes[i].len = 0;
+    }
+    if(n < size) break;
+  }
+  putchar(0);
+
+  if(fflush(stdout) != 0){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = 0; i < nlanes; i++){
+    if(!lanes[i].enc) continue;
+    encoderStats(lanes[i].enc, &stats);
+    total.bytesin += stats.bytesin;
+    total.bytesout += stats.bytesout;
+    total.codes += stats.codes;
+    total.escapes += stats.escapes;
+    total.prunes += stats.prunes;
+    total.lookups += stats.lookups;
+    total.hits += stats.hits;
+    encoderDestroy(lanes[i].enc);
+    bitWriterDestroy(lanes[i].out);
+    free(lanes[i].buf);
+  }
+  if(opt->stats){
+    printEncoderStats(stderr, &total);
+  }
+
+  free(lanes);
+  free(data);
+}
+
+// -----------------------------------------------------------------------------
+// void corrupt
+// -----------------------------------------------------------------------------
+// Description:
+//   reports a corrupt lane stream and exits
+// Parameters:
+//   uint64_t group - the number of the group where the problem was found
+
+static void corrupt(uint64_t group){
+  fprintf(stderr, "Error: input file corrupted in group %" PRIu64 "\n", group);
+  exit(EXIT_FAILURE);
+}
+
+void lanesDecode(Options* opt, FILE* in){
+  struct lane lanes[LANES_MAX];
+  Decoder decs[LANES_MAX];
+  int status[LANES_MAX];
+  Options streamopt = {.maxbits = 0};
+  uint64_t segsize, len, group, produced, position, footprint = 0, total = 0;
+  int nlanes, k, i, last = 0;
+
+  memset(lanes, 0, sizeof(lanes));
+  if(getc(in) != LANES_VERSION || (nlanes = getc(in)) < 1
+     || nlanes > LANES_MAX || readNumber(in, &segsize, 4) != 0
+     || segsize == 0){
+    fprintf(stderr, "Error: input file corrupted at byte 4\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(group = 0; (k = getc(in)) != 0; group++){
+    //only the last group may be short
+    if(k == EOF || k > nlanes || last) corrupt(group);
+
+    for(i = 0; i < k; i++){
+      if(readNumber(in, &lanes[i].size, 4) != 0 || lanes[i].size == 0
+         || lanes[i].size > segsize || readNumber(in, &len, 4) != 0){
+        corrupt(group);
+      }
+      if(len > lanes[i].packedcap){
+        lanes[i].packedcap = len;
+        lanes[i].packed = realloc(lanes[i].packed, len);
+      }
+      lanes[i].packedlen = len;
+      lanes[i].pos = 0;
+      last |= lanes[i].size < segsize;
+    }
+    last |= k < nlanes;
+
+    for(i = 0; i < k; i++){
+      if(fread(lanes[i].packed, 1, lanes[i].packedlen, in)
+         != lanes[i].packedlen){
+        corrupt(group);
+      }
+
+      //a lane's first segment starts with its stream header
+      if(!lanes[i].dec){
+        lanes[i].in = bitReaderCreate(packedSource, &lanes[i]);
+        if(decoderReadHeader(lanes[i].in, &streamopt) != 0) corrupt(group);
+        footprint += memoryFootprint(&streamopt);
+        if(opt->maxmemory && footprint > opt->maxmemory){
+          fprintf(stderr, "Error: stream needs more than %" PRIu64 " bytes "
+                  "of memory, more than --max-memory allows.\n", footprint);
+          exit(EXIT_FAILURE);
+        }
+        if(!opt->scan) lanes[i].out = bitWriterCreate(laneSink, &lanes[i]);
+        lanes[i].dec = decoderCreate(&streamopt, lanes[i].in, lanes[i].out);
+      }
+      decs[i] = lanes[i].dec;
+    }
+
+    decoderRunLanes(decs, status, k);
+
+    //each segment ends at a sync point, where its bytes have all been read
+    for(i = 0; i < k; i++){
+      decoderProgress(lanes[i].dec, &produced, &position);
+      if(status[i] != DECODE_SYNC
+         || bitsRead(lanes[i].in) != lanes[i].fed * CHAR_BIT
+         || produced - lanes[i].before != lanes[i].size){
+        corrupt(group);
+      }
+      lanes[i].before = produced;
+      total += lanes[i].size;
+      if(lanes[i].out){
+        sendRemainingBits(lanes[i].out);
+        fwrite(lanes[i].buf, 1, lanes[i].len, stdout);
+        lanes[i].len = 0;
+      }
+    }
+  }
+
+  if(getc(in) != EOF) corrupt(group);
+
+  if(fflush(stdout) != 0){
+    fprintf(stderr, "Error: could not write output\n");
+    exit(EXIT_FAILURE);
+  }
+  if(opt->scan){
+    printf("%" PRIu64 "\n", total);
+  }
+
+  for(i = 0; i < nlanes; i++){
+    if(!lanes[i].dec) continue;
+    decoderDestroy(lanes[i].dec);
+    bitReaderDestroy(lanes[i].in);
+    if(lanes[i].out) bitWriterDestroy(lanes[i].out);
+    free(lanes[i].buf);
+    free(lanes[i].packed);
+  }
+}
@@ -0,0 +1,52 @@
+/*
+lanes.h
+contains declarations for lane mode, which splits the input between several
+independent streams that are decoded together on one thread, so that their
+string table lookups overlap
+
+The input is cut into segments, dealt to the lanes in turn: segment i goes to
+lane i % lanes. Each lane is one compressed stream, with its own string table,
+continued over all of its segments.
+
+A lane stream starts with the magic "LZWL", a version byte, the number of
+lanes (1 byte) and the segment size (4 bytes, little endian), followed by a
+group for each round of segments and a 0 byte at the end. A group is the
+number of segments in it (1 byte, at most the number of lanes), then for each
+segment its length and the length of its compressed bytes (4 bytes each),
+then the compressed bytes of each segment in order, which end at a sync point
+of their lane's stream. Only the last group may have fewer segments than
+lanes, or segments shorter than the segment size.
+*/
+
+#define LANES_MAGIC "LZWL"        //the first bytes of a lane stream
+#define LANES_VERSION (1)         //the format version after the magic
+#define LANES_MAX (16)            //the most lanes a stream may have
+
+// -----------------------------------------------------------------------------
+// void lanesEncode
+// -----------------------------------------------------------------------------
+// Description:
+//   compresses the input in opt->lanes lanes, and writes the lane stream to
+//   stdout
+// Parameters:
+//   Options* opt - a pointer to an options struct containing the encoding
+//                  parameters used for every lane
+//   ByteSource in - the function supplying the bytes to compress
+//   void* ctx - the context pointer for in
+
+void lanesEncode(Options* opt, ByteSource in, void* ctx);
+
+// -----------------------------------------------------------------------------
+// void lanesDecode
+// -----------------------------------------------------------------------------
+// Description:
+//   decompresses a lane stream whose magic has already been read, running
+//   the lanes together with decoderRunLanes, and writes the result to stdout
+// Parameters:
+//   Options* opt - a pointer to an options struct. Streams needing more than
+//                  maxmemory for all their lanes are refused, and if scan is
+//                  set the stream is only checked, and its decompressed
+//                  length printed.
+//   FILE* in - the lane stream
+
+void lanesDecode(Options* opt, FILE* in);
@@ -7,10 +7,47 @@ by Geoffrey Litt
 */
 
 #include "globals.h"
+#include "bitio.h"
 #include "encode.h"
 #include "decode.h"
+#include "budget.h"
+#include "autotune.h"
+#include "server.h"
+#include "archive.h"
+#include "fields.h"
+#include "filter.h"
+#include "blocks.h"
+#include "dedup.h"
+#include "lanes.h"
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------
+// struct headsource
+// -----------------------------------------------------------------------------
+// Description:
+//   the context for headSource: bytes already read from a file, followed by
+//   the rest of the file
+// Fields:
+//   unsigned char* head - the bytes already read
+//   size_t len - the number of bytes in head
+//   size_t pos - the number of bytes of head already supplied
+//   FILE* file - the file the rest of the input comes from
+
+struct headsource{
+  unsigned char* head;
+  size_t len;
+  size_t pos;
+  FILE* file;
+};
 
 void parseArguments(int argc, char** argv, Options *opt);
+int execNamed(char* path, char* name);
+uint64_t parseSize(char* arg);
+int parseThreads(char* arg);
+int parseByte(char* arg);
+void applyMemoryBudget(Options *opt);
+void printDryRun(Options *opt, int tables);
+size_t headSource(void* ctx, unsigned char* buf, size_t n);
 
 // -----------------------------------------------------------------------------
 // int main
@@ -24,16 +61,194 @@ void parseArguments(int argc, char** argv, Options *opt);
 //   0 - indicates successful completion of the program
 
 int main(int argc, char* argv[]){
-  Options opt = {.decode = 0, .maxbits = 12, .prune = 0, .escape = 0};
+  Options opt = {.decode = 0, .maxbits = 0, .prune = 0, .escape = 0,
+                 .maxmemory = 0, .dryrun = 0, .autotune = 0, .autoweight = 0,
+                 .checkpoint = 0, .resume = 0, .flushms = 0, .flushnewline = 0,
+                 .verify = 0, .scan = 0, .stats = 0, .longmatch = 0,
+                 .best = 0, .socket = 0, .threads = 0, .queue = 0, .archive = 0,
+                 .filelist = 0, .list = 0, .paths = 0, .npaths = 0,
+                 .fields = 0, .delimiter = ',', .separator = '\n',
+                 .filter = 0, .dedup = 0, .lanes = 0};
+  struct headsource in = {.head = 0, .len = 0, .pos = 0, .file = stdin};
+  FILE* f;
+
   parseArguments(argc, argv, &opt);
 
   if(opt.decode){
-    decode();
+    decode(&opt);
+    return 0;
+  }
+
+  if(opt.socket){
+    serve(&opt);
+    return 0;
+  }
+
+  if(opt.autotune && (opt.flushms || opt.flushnewline)){
+    fprintf(stderr, "Error: --auto can't be used with --flush-ms or "
+            "--flush-on-newline.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(opt.best && opt.longmatch){
+    fprintf(stderr, "Error: --best can't be used with --long-match.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(opt.dedup && (opt.archive || opt.fields || opt.filter)){
+    fprintf(stderr, "Error: --dedup can't be used with --archive, --fields "
+            "or --filter.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(opt.lanes && (opt.archive || opt.fields || opt.filter || opt.dedup)){
+    fprintf(stderr, "Error: --lanes can't be used with --archive, --fields, "
+            "--filter or --dedup.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(opt.archive){
+    if(opt.autotune || opt.flushms || opt.flushnewline || opt.verify
+       || opt.checkpoint || opt.resume){
+      fprintf(stderr, "Error: --auto, --flush-ms, --flush-on-newline, "
+              "--verify, --checkpoint and --resume can't be used with "
+              "--archive.\n");
+      exit(EXIT_FAILURE);
+    }
+    applyMemoryBudget(&opt);
+    //at most one table per thread, fewer if there are fewer members
+    if(opt.dryrun) printDryRun(&opt, threadsInBudget(&opt, &opt));
+    else archiveCreate(&opt);
+    free(opt.paths);
+    return 0;
+  }
+  if(opt.npaths || opt.filelist){
+    fprintf(stderr, "Error: paths can only be given with --archive.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(opt.filter){
+    if(opt.autotune || opt.flushms || opt.flushnewline || opt.verify
+       || opt.checkpoint || opt.resume || opt.fields){
+      fprintf(stderr, "Error: --auto, --flush-ms, --flush-on-newline, "
+              "--verify, --checkpoint, --resume and --fields can't be used "
+              "with --filter.\n");
+      exit(EXIT_FAILURE);
+    }
+    applyMemoryBudget(&opt);
+    if(opt.dryrun) printDryRun(&opt, 1);
+    else filterEncode(&opt, headSource, &in);
+    return 0;
+  }
+
+  if(opt.fields){
+    if(opt.autotune || opt.flushms || opt.flushnewline || opt.verify
+       || opt.checkpoint || opt.resume){
+      fprintf(stderr, "Error: --auto, --flush-ms, --flush-on-newline, "
+              "--verify, --checkpoint and --resume can't be used with "
+              "--fields.\n");
+      exit(EXIT_FAILURE);
+    }
+    if(opt.delimiter == opt.separator){
+      fprintf(stderr, "Error: the delimiter and record separator must be "
+              "different.\n");
+      exit(EXIT_FAILURE);
+    }
+    applyMemoryBudget(&opt);
+    if(opt.dryrun) printDryRun(&opt, FIELDS_MAXCOLUMNS);
+    else fieldsEncode(&opt, headSource, &in);
+    return 0;
+  }
+
+  if(opt.dedup){
+    if(opt.flushms || opt.flushnewline || opt.verify || opt.checkpoint
+       || opt.resume){
+      fprintf(stderr, "Error: --flush-ms, --flush-on-newline, --verify, "
+              "--checkpoint and --resume can't be used with --dedup.\n");
+      exit(EXIT_FAILURE);
+    }
+    if(opt.autotune){
+      autoTuneFile(&opt, stdin, &in.head, &in.len);
+    }
+    applyMemoryBudget(&opt);
+    if(opt.dryrun) printDryRun(&opt, 1);
+    else dedupEncode(&opt, headSource, &in);
+    free(in.head);
+    return 0;
+  }
+
+  if(opt.lanes){
+    if(opt.flushms || opt.flushnewline || opt.verify || opt.checkpoint
+       || opt.resume){
+      fprintf(stderr, "Error: --flush-ms, --flush-on-newline, --verify, "
+              "--checkpoint and --resume can't be used with --lanes.\n");
+      exit(EXIT_FAILURE);
+    }
+    if(opt.autotune){
+      autoTuneFile(&opt, stdin, &in.head, &in.len);
+    }
+    applyMemoryBudget(&opt);
+    if(opt.dryrun) printDryRun(&opt, opt.lanes);
+    else lanesEncode(&opt, headSource, &in);
+    free(in.head);
+    return 0;
+  }
+
+  //--best on its own compresses blocks of a large input on several threads
+  if(opt.best){
+    if(opt.flushms || opt.flushnewline || opt.verify || opt.checkpoint
+       || opt.resume){
+      fprintf(stderr, "Error: --flush-ms, --flush-on-newline, --verify, "
+              "--checkpoint and --resume can't be used with --best.\n");
+      exit(EXIT_FAILURE);
+    }
+    if(opt.autotune){
+      autoTuneFile(&opt, stdin, &in.head, &in.len);
+    }
+    applyMemoryBudget(&opt);
+    if(opt.dryrun) printDryRun(&opt, threadsInBudget(&opt, &opt));
+    else blocksEncode(&opt, headSource, &in);
+    free(in.head);
+    return 0;
+  }
+
+  if(opt.resume){
+    //the parameters come from the checkpoint
+    if(opt.maxbits || opt.prune || opt.escape || opt.autotune || opt.verify){
+      fprintf(stderr, "Error: -m, -p, -e, --auto and --verify can't be used "
+              "with --resume.\n");
+      exit(EXIT_FAILURE);
+    }
+    if(opt.dryrun){
+      if((f = fopen(opt.resume, "rb")) == 0
+         || encoderCheckpointParameters(f, &opt) != 0){
+        fprintf(stderr, "Error: %s is not a valid checkpoint.\n", opt.resume);
+        exit(EXIT_FAILURE);
+      }
+      fclose(f);
+      printDryRun(&opt, 1);
+    }
+    else{
+      encode(&opt, headSource, &in);
+    }
+    return 0;
+  }
+
+  if(opt.autotune){
+    autoTuneFile(&opt, stdin, &in.head, &in.len);
+  }
+
+  applyMemoryBudget(&opt);
+
+  if(opt.dryrun){
+    printDryRun(&opt, 1);
   }
   else{
-    encode(&opt);
+    encode(&opt, headSource, &in);
   }
 
+  free(in.head);
+
   return 0;
 }
 
@@ -52,33 +267,83 @@ int main(int argc, char* argv[]){
 
 void parseArguments(int argc, char** argv, Options *opt){
   int i;
-  long j;
-  char* execname = malloc(7*sizeof(char)); //6 chars for encode/decode + null
+  long long j;
+
+  //paths are given after the options, so there are fewer than argc of them
+  opt->paths = malloc(argc * sizeof(char*));
 
-  for(i = 0; i < 6; i++){
-    execname[i] = argv[0][strlen(argv[0]) - 6 + i];
+  //decode takes no encoding parameters, they are in the stream
+  if(execNamed(argv[0], "decode")){
+    opt->decode = 1;
+    for(i = 1; i < argc; i++){
+      if(!strcmp(argv[i], "--max-memory") && argc > i + 1){
+        opt->maxmemory = parseSize(argv[++i]);
+      }
+      else if(!strcmp(argv[i], "--test") || !strcmp(argv[i], "--size")){
+        opt->scan = 1;
+      }
+      else if(!strcmp(argv[i], "--list")){
+        opt->list = 1;
+      }
+      else if(!strcmp(argv[i], "-j") && argc > i + 1){
+        opt->threads = parseThreads(argv[++i]);
+      }
+      else if(argv[i][0] != '-'){
+        opt->paths[opt->npaths++] = argv[i];
+      }
+      else{
+        fprintf(stderr, "Error: invalid option %s specified.\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
   }
-  execname[6] = '\0';
 
-  //no arguments parsing if called as decode
-  if(!strcmp(execname, "decode")){
-    if(argc > 1){
-      fprintf(stderr, "Error: no arguments should be passed to decode.\n");
+  //lzwd takes the socket path, and gets the parameters with each request
+  else if(execNamed(argv[0], "lzwd")){
+    for(i = 1; i < argc; i++){
+      if(!strcmp(argv[i], "-j") && argc > i + 1){
+        opt->threads = parseThreads(argv[++i]);
+      }
+      else if(!strcmp(argv[i], "--queue") && argc > i + 1){
+        if((j = strtoll(argv[++i], 0, 10)) <= 0 || j > 65536){
+          fprintf(stderr, "Error: --queue must be between 1 and 65536.\n");
+          exit(EXIT_FAILURE);
+        }
+        opt->queue = (int)j;
+      }
+      else if(!strcmp(argv[i], "--max-memory") && argc > i + 1){
+        opt->maxmemory = parseSize(argv[++i]);
+      }
+      else if(argv[i][0] != '-' && !opt->socket){
+        opt->socket = argv[i];
+      }
+      else{
+        fprintf(stderr, "Error: invalid option %s specified.\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if(!opt->socket){
+      fprintf(stderr, "Error: lzwd needs the path of a socket to listen on.\n");
       exit(EXIT_FAILURE);
     }
-    else{
-      opt->decode = 1;
+    if(!opt->threads){
+      opt->threads = sysconf(_SC_NPROCESSORS_ONLN) > 0
+                     ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    }
+    if(!opt->queue){
+      opt->queue = 64;
     }
   }
 
-  else if(!strcmp(execname, "encode")){
+  else if(execNamed(argv[0], "encode")){
     for(i = 1; i < argc; i++){
 
       //handle the -m flag
       //increment i to look at the argument after the flag
       if(!strcmp(argv[i], "-m")){
-        if(argc > ++i && (j = strtol(argv[i], 0, 10)) > 0){
-          if(j <= (CHAR_BIT) || j > (3*CHAR_BIT)){
+        if(argc > ++i && (j = strtoll(argv[i], 0, 10)) > 0){
+          if(j < MIN_MAXBITS || j > MAX_MAXBITS){
             j = 12;
           }
           opt->maxbits = (int)j;
@@ -92,11 +357,13 @@ void parseArguments(int argc, char** argv, Options *opt){
       //handle the -p flag
       //increment i to look at the argument after the flag
       else if(!strcmp(argv[i], "-p")){
-        if(argc > ++i && (j = strtol(argv[i], 0, 10)) > 0){
-          opt->prune = (int)j;
+        if(argc > ++i && (j = strtoll(argv[i], 0, 10)) > 0
+           && j < ((int64_t)1 << BITS_TO_SEND_WINDOW_EXT)){
+          opt->prune = (int64_t)j;
         }
         else{
-          fprintf(stderr, "Error: WINDOW must be a positive integer.\n");
+          fprintf(stderr, "Error: WINDOW must be a positive integer "
+                  "less than 2^%d.\n", BITS_TO_SEND_WINDOW_EXT);
           exit(EXIT_FAILURE);
         }
       }
@@ -106,6 +373,126 @@ void parseArguments(int argc, char** argv, Options *opt){
         opt->escape = 1;
       }
 
+      //handle the --max-memory flag
+      else if(!strcmp(argv[i], "--max-memory") && argc > i + 1){
+        opt->maxmemory = parseSize(argv[++i]);
+      }
+
+      //handle the --auto flag, its argument is the objective
+      else if(!strcmp(argv[i], "--auto") && argc > i + 1){
+        char* end;
+        opt->autotune = 1;
+        i++;
+        if(!strcmp(argv[i], "ratio")){
+          opt->autoweight = 0;
+        }
+        else if(!strcmp(argv[i], "speed")){
+          opt->autoweight = 1;
+        }
+        else if((opt->autoweight = strtod(argv[i], &end)) < 0
+                || opt->autoweight > 1 || *end != '\0' || end == argv[i]){
+          fprintf(stderr, "Error: --auto takes ratio, speed, or a weight "
+                  "between 0 and 1.\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+
+      //handle the --flush-ms and --flush-on-newline flags
+      else if(!strcmp(argv[i], "--flush-ms") && argc > i + 1){
+        if((j = strtoll(argv[++i], 0, 10)) <= 0 || j > INT_MAX){
+          fprintf(stderr, "Error: --flush-ms must be a positive integer.\n");
+          exit(EXIT_FAILURE);
+        }
+        opt->flushms = (int)j;
+      }
+      else if(!strcmp(argv[i], "--flush-on-newline")){
+        opt->flushnewline = 1;
+      }
+
+      //handle the --verify flag
+      else if(!strcmp(argv[i], "--verify")){
+        opt->verify = 1;
+      }
+
+      //handle the --checkpoint and --resume flags
+      else if(!strcmp(argv[i], "--checkpoint") && argc > i + 1){
+        opt->checkpoint = argv[++i];
+      }
+      else if(!strcmp(argv[i], "--resume") && argc > i + 1){
+        opt->resume = argv[++i];
+      }
+
+      //handle the --archive flag and its paths
+      else if(!strcmp(argv[i], "--archive")){
+        opt->archive = 1;
+      }
+      else if(!strcmp(argv[i], "--files-from") && argc > i + 1){
+        opt->filelist = argv[++i];
+      }
+      else if(!strcmp(argv[i], "-j") && argc > i + 1){
+        opt->threads = parseThreads(argv[++i]);
+      }
+      else if(argv[i][0] != '-'){
+        opt->paths[opt->npaths++] = argv[i];
+      }
+
+      //handle the --fields flag and its separators
+      else if(!strcmp(argv[i], "--fields")){
+        opt->fields = 1;
+      }
+      else if(!strcmp(argv[i], "--delimiter") && argc > i + 1){
+        opt->delimiter = parseByte(argv[++i]);
+      }
+      else if(!strcmp(argv[i], "--record-separator") && argc > i + 1){
+        opt->separator = parseByte(argv[++i]);
+      }
+
+      //handle the --filter flag, checking the list now
+      else if(!strcmp(argv[i], "--filter") && argc > i + 1){
+        FilterChain fc = filterChainParse(argv[++i]);
+        if(!fc){
+          fprintf(stderr, "Error: invalid filter list %s.\n", argv[i]);
+          exit(EXIT_FAILURE);
+        }
+        filterChainDestroy(fc);
+        opt->filter = argv[i];
+      }
+
+      //handle the --stats flag
+      else if(!strcmp(argv[i], "--stats")){
+        opt->stats = 1;
+      }
+
+      //handle the --long-match flag
+      else if(!strcmp(argv[i], "--long-match")){
+        opt->longmatch = 1;
+      }
+
+      //handle the --best flag
+      else if(!strcmp(argv[i], "--best")){
+        opt->best = 1;
+      }
+
+      //handle the --dedup flag
+      else if(!strcmp(argv[i], "--dedup")){
+        opt->dedup = 1;
+      }
+
+      //handle the --lanes flag
+      else if(!strcmp(argv[i], "--lanes") && argc > i + 1){
+        if((j = strtoll(argv[++i], 0, 10)) < 2 || j > LANES_MAX){
+          fprintf(stderr, "Error: --lanes must be between 2 and %d.\n",
+                  LANES_MAX);
+          exit(EXIT_FAILURE);
+        }
+        opt->lanes = (int)j;
+      }
+
+      //handle the --dry-run flag
+      else if(!strcmp(argv[i], "--dry-run")){
+        opt->dryrun = 1;
+      }
+
       else{
         fprintf(stderr, "Error: invalid option %s specified.\n", argv[i]);
         exit(EXIT_FAILURE);
@@ -115,9 +502,187 @@ void parseArguments(int argc, char** argv, Options *opt){
 
   else{
     //should never happen, but why not handle the error gracefully
-    fprintf(stderr, "Error: invalid executable name. Must be encode or decode");
+    fprintf(stderr, "Error: invalid executable name. Must be encode, decode "
+            "or lzwd.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// int execNamed
+// -----------------------------------------------------------------------------
+// Description
+//   checks which program the executable was run as
+// Parameters:
+//   char* path - the path the program was run with, argv[0]
+//   char* name - the program name to check for
+// Return value:
+//   1 if path ends with name, 0 otherwise
+
+int execNamed(char* path, char* name){
+  size_t len = strlen(path), namelen = strlen(name);
+
+  return len >= namelen && !strcmp(path + len - namelen, name);
+}
+
+// -----------------------------------------------------------------------------
+// uint64_t parseSize
+// -----------------------------------------------------------------------------
+// Description
+//   parses a byte count with an optional K, M, G or T (binary) suffix
+// Parameters:
+//   char* arg - the command line argument to parse
+// Return value:
+//   the number of bytes, exits the program if the argument is invalid
+
+uint64_t parseSize(char* arg){
+  char* end;
+  unsigned long long n = strtoull(arg, &end, 10);
+  int shift = 0;
+
+  switch(*end){
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    case 't': case 'T': shift = 40; end++; break;
+  }
+
+  if(end == arg || *end != '\0' || n == 0 || n > (UINT64_MAX >> shift)){
+    fprintf(stderr, "Error: invalid size %s.\n", arg);
     exit(EXIT_FAILURE);
   }
 
-  free(execname);
+  return (uint64_t)n << shift;
+}
+
+// -----------------------------------------------------------------------------
+// int parseThreads
+// -----------------------------------------------------------------------------
+// Description
+//   parses the number of threads given with -j
+// Parameters:
+//   char* arg - the command line argument to parse
+// Return value:
+//   the number of threads, exits the program if the argument is invalid
+
+int parseThreads(char* arg){
+  char* end;
+  long long n = strtoll(arg, &end, 10);
+
+  if(end == arg || *end != '\0' || n <= 0 || n > 1024){
+    fprintf(stderr, "Error: THREADS must be between 1 and 1024.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return (int)n;
+}
+
+// -----------------------------------------------------------------------------
+// int parseByte
+// -----------------------------------------------------------------------------
+// Description
+//   parses a delimiter: a single character, or one of the escapes \t, \n,
+//   \r and \0
+// Parameters:
+//   char* arg - the command line argument to parse
+// Return value:
+//   the byte, exits the program if the argument is invalid
+
+int parseByte(char* arg){
+  if(strlen(arg) == 1) return (unsigned char)arg[0];
+
+  if(strlen(arg) == 2 && arg[0] == '\\'){
+    switch(arg[1]){
+      case 't': return '\t';
+      case 'n': return '\n';
+      case 'r': return '\r';
+      case '0': return '\0';
+      case '\\': return '\\';
+    }
+  }
+
+  fprintf(stderr, "Error: invalid delimiter %s, give one character or one "
+          "of \\t, \\n, \\r and \\0.\n", arg);
+  exit(EXIT_FAILURE);
+}
+
+// -----------------------------------------------------------------------------
+// void applyMemoryBudget
+// -----------------------------------------------------------------------------
+// Description
+//   picks maxbits if it wasn't given, and makes the parameters fit into the
+//   --max-memory budget. Without -m the largest maxbits that fits is used,
+//   an explicit -m is lowered with a warning if it doesn't fit. In field
+//   mode the budget is shared by all the columns' tables.
+// Parameters:
+//   Options *opt - a pointer to the parsed Options struct
+// External state:
+//   modifies the maxbits field of the Options struct passed in
+
+void applyMemoryBudget(Options *opt){
+  int explicit = opt->maxbits != 0;
+  uint64_t budget = opt->maxmemory / (opt->fields ? FIELDS_MAXCOLUMNS
+                                      : opt->lanes ? opt->lanes : 1);
+  int requested;
+
+  if(!explicit){
+    opt->maxbits = opt->maxmemory ? MAX_MAXBITS : DEFAULT_MAXBITS;
+  }
+  if(!opt->maxmemory) return;
+
+  requested = opt->maxbits;
+  switch(fitMemoryBudget(opt, budget)){
+    case -1:
+      opt->maxbits = MIN_MAXBITS;
+      fprintf(stderr, "Error: --max-memory is too small, at least %" PRIu64
+              " bytes are needed.\n", memoryFootprint(opt));
+      exit(EXIT_FAILURE);
+    case 1:
+      if(explicit){
+        fprintf(stderr, "Warning: MAXBITS lowered from %d to %d to fit in "
+                "--max-memory.\n", requested, opt->maxbits);
+      }
+      break;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// void printDryRun
+// -----------------------------------------------------------------------------
+// Description
+//   prints the parameters that would be used for --dry-run, and the memory
+//   footprint of all the string tables the chosen mode creates
+// Parameters:
+//   Options *opt - a pointer to the Options struct holding the parameters
+//   int tables - the number of string tables the mode creates
+
+void printDryRun(Options *opt, int tables){
+  printf("maxbits %d\nwindow %" PRId64 "\nescape %d\nfootprint %" PRIu64
+         " bytes\n", opt->maxbits, opt->prune, opt->escape,
+         tables * memoryFootprint(opt));
+}
+
+// -----------------------------------------------------------------------------
+// size_t headSource
+// -----------------------------------------------------------------------------
+// Description
+//   a ByteSource which supplies the bytes of a struct headsource
+// Parameters:
+//   void* ctx - a pointer to the struct headsource
+//   unsigned char* buf - the buffer to fill
+//   size_t n - the size of buf
+// Return value:
+//   the number of bytes supplied, 0 at the end of the input
+
+size_t headSource(void* ctx, unsigned char* buf, size_t n){
+  struct headsource* hs = ctx;
+
+  if(hs->pos < hs->len){
+    if(n > hs->len - hs->pos) n = hs->len - hs->pos;
+    memcpy(buf, hs->head + hs->pos, n);
+    hs->pos += n;
+    return n;
+  }
+
+  return fread(buf, 1, n, hs->file);
 }
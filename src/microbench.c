@@ -0,0 +1,562 @@
+/*
+microbench.c
+contains microbenchmarks of the string table and bit I/O primitives, and of
+encoding throughput, built and run by `make microbench`
+
+Each benchmark reports the time per operation, and where the kernel allows
+perf_event_open, the cycles, instructions, cache misses and branch misses per
+operation counted in user space. The inputs come from a fixed random seed, so
+runs can be compared with each other.
+*/
+
+#define _GNU_SOURCE
+#include "globals.h"
+#include "bitio.h"
+#include "hasharray.h"
+#include "encode.h"
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define BENCH_MAXBITS (18)        //maxbits of the tables benchmarked
+#define BENCH_OPS (1 << 22)       //lookups and bit I/O calls per benchmark
+#define BENCH_ROUNDS (5)          //times the insert and prune tables are built
+#define NUM_COUNTERS (4)          //hardware counters read
+#define BENCH_TEXT (1 << 24)      //bytes of text encoded per benchmark
+
+// -----------------------------------------------------------------------------
+// struct counters
+// -----------------------------------------------------------------------------
+// Description:
+//   the hardware counters and clock around one benchmark
+// Fields:
+//   int fd[] - the perf event of each counter, -1 if it is not available
+//   uint64_t value[] - the counts of the last measurement
+//   int64_t start - the clock when the measurement started, in nanoseconds
+//   int64_t ns - the length of the last measurement, in nanoseconds
+
+struct counters{
+  int fd[NUM_COUNTERS];
+  uint64_t value[NUM_COUNTERS];
+  int64_t start;
+  int64_t ns;
+};
+
+static const uint64_t counterConfig[NUM_COUNTERS] = {
+  PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static uint64_t seed = 88172645463325252ull;
+
+// -----------------------------------------------------------------------------
+// uint32_t randomNumber
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the next number of a xorshift generator
+
+static uint32_t randomNumber(void){
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return (uint32_t)(seed >> 32);
+}
+
+// -----------------------------------------------------------------------------
+// int64_t nanoseconds
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the current time of a monotonic clock in nanoseconds
+
+static int64_t nanoseconds(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// -----------------------------------------------------------------------------
+// void countersOpen
+// -----------------------------------------------------------------------------
+// Description:
+//   opens the hardware counters disabled, as one group led by the cycle
+//   counter, leaving the fds of those which are not available at -1. If the
+//   cycle counter itself is not available, the others are opened on their
+//   own. Each counter also reports how long it was
+//   enabled and running, so counts are scaled up when the kernel had to
+//   multiplex the group with other events.
+// Parameters:
+//   struct counters* c - the counters
+
+static void countersOpen(struct counters* c){
+  struct perf_event_attr attr;
+  int i;
+
+  for(i = 0; i < NUM_COUNTERS; i++){
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = counterConfig[i];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                       | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    c->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+                       i == 0 ? -1 : c->fd[0], 0);
+  }
+}
+
+static void countersStart(struct counters* c){
+  int i;
+
+  if(c->fd[0] >= 0){
+    ioctl(c->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(c->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  else{
+    for(i = 1; i < NUM_COUNTERS; i++){
+      if(c->fd[i] < 0) continue;
+      ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  c->start = nanoseconds();
+}
+
+static void countersStop(struct counters* c){
+  uint64_t data[3];   //the value, time enabled and time running
+  int i;
+
+  c->ns = nanoseconds() - c->start;
+  if(c->fd[0] >= 0){
+    ioctl(c->fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  }
+  else{
+    for(i = 1; i < NUM_COUNTERS; i++){
+      if(c->fd[i] >= 0) ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  for(i = 0; i < NUM_COUNTERS; i++){
+    if(c->fd[i] < 0 || read(c->fd[i], data, sizeof(data)) != sizeof(data)
+       || data[2] == 0){
+      c->value[i] = 0;
+    }
+    else if(data[2] < data[1]){
+      c->value[i] = (uint64_t)((double)data[0] * data[1] / data[2]);
+    }
+    else{
+      c->value[i] = data[0];
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+// void report
+// -----------------------------------------------------------------------------
+// Description:
+//   prints a line of results, per operation
+// Parameters:
+//   const char* name - the name of the benchmark
+//   struct counters* c - the counters of the measurement
+//   uint64_t ops - the number of operations measured
+
+static void report(const char* name, struct counters* c, uint64_t ops){
+  int i;
+
+  printf("%-28s %10.2f", name, (double)c->ns / ops);
+  for(i = 0; i < NUM_COUNTERS; i++){
+    if(c->fd[i] >= 0) printf(" %10.2f", (double)c->value[i] / ops);
+    else printf(" %10s", "-");
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+// -----------------------------------------------------------------------------
+// void fillTable
+// -----------------------------------------------------------------------------
+// Description:
+//   adds random strings to a table, each one char longer than a random
+//   string already in it and not in it yet, and gives every entry a sent time
+// Parameters:
+//   HashArray ha - the table
+//   int count - the number of entries the table should end up with
+
+static void fillTable(HashArray ha, int count){
+  int code, kar, prefix;
+
+  while(HashArrayElts(ha) < count){
+    kar = randomNumber() & 0xff;
+    prefix = NUM_SPECIALS + randomNumber() % (HashArrayElts(ha) - NUM_SPECIALS);
+    if(HashArrayCharPrefixLookup(ha, kar, prefix) == 0){
+      HashArrayInsert(ha, kar, prefix);
+    }
+  }
+  for(code = NUM_SPECIALS; code < count; code++){
+    HashArrayUpdateSentTime(ha, code, code);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// void benchInsert
+// -----------------------------------------------------------------------------
+// Description:
+//   times HashArrayInsert filling an empty table to the top. The strings are
+//   picked by filling the table once untimed, so none is inserted twice.
+
+static void benchInsert(struct counters* c){
+  int size = 1 << BENCH_MAXBITS, base, n, i, round;
+  int *kars = malloc(size * sizeof(int));
+  int *prefixes = malloc(size * sizeof(int));
+  HashArray ha = HashArrayCreate(size, 0);
+  struct counters total = *c;
+  char name[64];
+
+  memset(total.value, 0, sizeof(total.value));
+  total.ns = 0;
+  base = HashArrayElts(ha);
+  n = size - base;
+
+  for(round = 0; round < BENCH_ROUNDS; round++){
+    HashArrayReset(ha, 0);
+    for(i = 0; i < n; ){
+      kars[i] = randomNumber() & 0xff;
+      prefixes[i] = NUM_SPECIALS + randomNumber() % (base + i - NUM_SPECIALS);
+      if(HashArrayCharPrefixLookup(ha, kars[i], prefixes[i]) == 0){
+        HashArrayInsert(ha, kars[i], prefixes[i]);
+        i++;
+      }
+    }
+    HashArrayReset(ha, 0);
+
+    countersStart(c);
+    for(i = 0; i < n; i++){
+      HashArrayInsert(ha, kars[i], prefixes[i]);
+    }
+    countersStop(c);
+
+    total.ns += c->ns;
+    for(i = 0; i < NUM_COUNTERS; i++) total.value[i] += c->value[i];
+  }
+
+  sprintf(name, "insert to full 2^%d", BENCH_MAXBITS);
+  report(name, &total, (uint64_t)n * BENCH_ROUNDS);
+
+  HashArrayDestroy(ha);
+  free(kars);
+  free(prefixes);
+}
+
+// -----------------------------------------------------------------------------
+// void benchLookup
+// -----------------------------------------------------------------------------
+// Description:
+//   times HashArrayCharPrefixLookup of strings in the table and not in it,
+//   with the table filled to several levels
+
+static void benchLookup(struct counters* c){
+  static const int levels[] = {25, 50, 75, 100};
+  int size = 1 << BENCH_MAXBITS, i, l, code, kar, prefix, found;
+  int *kars = malloc(BENCH_OPS * sizeof(int));
+  int *prefixes = malloc(BENCH_OPS * sizeof(int));
+  HashArray ha = HashArrayCreate(size, 0);
+  struct elt* e;
+  char name[64];
+
+  for(l = 0; l < (int)(sizeof(levels) / sizeof(levels[0])); l++){
+    fillTable(ha, (int)((int64_t)size * levels[l] / 100));
+
+    //strings in the table, in random order
+    for(i = 0; i < BENCH_OPS; i++){
+      code = NUM_SPECIALS + randomNumber() % (HashArrayElts(ha) - NUM_SPECIALS);
+      e = HashArrayCodeLookup(ha, code);
+      kars[i] = e->kar;
+      prefixes[i] = e->prefix;
+    }
+    found = 0;
+    countersStart(c);
+    for(i = 0; i < BENCH_OPS; i++){
+      found += HashArrayCharPrefixLookup(ha, kars[i], prefixes[i]) != 0;
+    }
+    countersStop(c);
+    sprintf(name, "lookup hit %d%% full", levels[l]);
+    report(name, c, BENCH_OPS);
+    if(found != BENCH_OPS){
+      fprintf(stderr, "Error: lookup missed strings in the table.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    //strings not in the table
+    for(i = 0; i < BENCH_OPS; i++){
+      do{
+        kar = randomNumber() & 0xff;
+        prefix = NUM_SPECIALS
+                 + randomNumber() % (HashArrayElts(ha) - NUM_SPECIALS);
+      } while(HashArrayCharPrefixLookup(ha, kar, prefix));
+      kars[i] = kar;
+      prefixes[i] = prefix;
+    }
+    found = 0;
+    countersStart(c);
+    for(i = 0; i < BENCH_OPS; i++){
+      found += HashArrayCharPrefixLookup(ha, kars[i], prefixes[i]) != 0;
+    }
+    countersStop(c);
+    sprintf(name, "lookup miss %d%% full", levels[l]);
+    report(name, c, BENCH_OPS);
+    if(found != 0){
+      fprintf(stderr, "Error: lookup found strings not in the table.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  HashArrayDestroy(ha);
+  free(kars);
+  free(prefixes);
+}
+
+// -----------------------------------------------------------------------------
+// void benchPrune
+// -----------------------------------------------------------------------------
+// Description:
+//   times HashArrayPrune of a full table with several windows, per entry of
+//   the full table
+
+static void benchPrune(struct counters* c){
+  static const int divisors[] = {64, 8, 2, 1};
+  int size = 1 << BENCH_MAXBITS, d, round, i;
+  struct counters total = *c;
+  HashArray ha;
+  char name[64];
+
+  for(d = 0; d < (int)(sizeof(divisors) / sizeof(divisors[0])); d++){
+    memset(total.value, 0, sizeof(total.value));
+    total.ns = 0;
+
+    for(round = 0; round < BENCH_ROUNDS; round++){
+      ha = HashArrayCreate(size, 0);
+      fillTable(ha, size);
+
+      countersStart(c);
+      ha = HashArrayPrune(ha, size / divisors[d], 0, size);
+      countersStop(c);
+
+      total.ns += c->ns;
+      for(i = 0; i < NUM_COUNTERS; i++) total.value[i] += c->value[i];
+      HashArrayDestroy(ha);
+    }
+
+    sprintf(name, "prune 2^%d window 1/%d", BENCH_MAXBITS, divisors[d]);
+    report(name, &total, (uint64_t)size * BENCH_ROUNDS);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// struct membuf
+// -----------------------------------------------------------------------------
+// Description:
+//   a buffer in memory that memSink appends to and memSource reads from
+// Fields:
+//   unsigned char* data - the bytes
+//   size_t len - the number of bytes in data
+//   size_t cap - the number of bytes allocated for data
+//   size_t pos - the number of bytes already read
+
+struct membuf{
+  unsigned char* data;
+  size_t len;
+  size_t cap;
+  size_t pos;
+};
+
+static size_t memSink(void* ctx, const unsigned char* buf, size_t n){
+  struct membuf* m = ctx;
+
+  if(m->len + n > m->cap){
+    m->cap = m->len + n > 2 * m->cap ? m->len + n : 2 * m->cap;
+    m->data = realloc(m->data, m->cap);
+  }
+  memcpy(m->data + m->len, buf, n);
+  m->len += n;
+
+  return n;
+}
+
+static size_t memSource(void* ctx, unsigned char* buf, size_t n){
+  struct membuf* m = ctx;
+
+  if(n > m->len - m->pos) n = m->len - m->pos;
+  memcpy(buf, m->data + m->pos, n);
+  m->pos += n;
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void benchBits
+// -----------------------------------------------------------------------------
+// Description:
+//   times putBits and getBits at every code width from 3 to 24 bits
+
+static void benchBits(struct counters* c){
+  //room for every width, so memSink never reallocates while timed
+  struct membuf m = {.data = malloc((size_t)BENCH_OPS * 24 / CHAR_BIT + 8),
+                     .len = 0, .cap = (size_t)BENCH_OPS * 24 / CHAR_BIT + 8,
+                     .pos = 0};
+  int* values = malloc(BENCH_OPS * sizeof(int));
+  BitWriter bw = bitWriterCreate(memSink, &m);
+  BitReader br = bitReaderCreate(memSource, &m);
+  int width, i, bad;
+  char name[64];
+
+  for(width = 3; width <= 24; width++){
+    for(i = 0; i < BENCH_OPS; i++){
+      values[i] = randomNumber() & ((1 << width) - 1);
+    }
+
+    //write into memory that is already allocated, so only putBits is timed
+    m.len = 0;
+    bitWriterReset(bw);
+    countersStart(c);
+    for(i = 0; i < BENCH_OPS; i++){
+      putBits(bw, width, values[i]);
+    }
+    countersStop(c);
+    sendRemainingBits(bw);
+    sprintf(name, "putBits %d", width);
+    report(name, c, BENCH_OPS);
+
+    m.pos = 0;
+    bitReaderReset(br);
+    bad = 0;
+    countersStart(c);
+    for(i = 0; i < BENCH_OPS; i++){
+      bad |= getBits(br, width) ^ values[i];
+    }
+    countersStop(c);
+    sprintf(name, "getBits %d", width);
+    report(name, c, BENCH_OPS);
+    if(bad){
+      fprintf(stderr, "Error: getBits returned a different code than putBits "
+              "wrote at width %d.\n", width);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  bitWriterDestroy(bw);
+  bitReaderDestroy(br);
+  free(values);
+  free(m.data);
+}
+
+// -----------------------------------------------------------------------------
+// void benchEncode
+// -----------------------------------------------------------------------------
+// Description:
+//   times encoding generated log lines at -m 20 and -m 24, where the string
+//   table no longer fits in the CPU cache, and shows how many lookups the
+//   hot index answered
+
+static void benchEncode(struct counters* c){
+  static const char* words[] = {"GET", "POST", "/index.html", "/api/v1/users",
+    "/static/app.js", "200", "304", "404", "Mozilla/5.0", "curl/7.68.0",
+    "session=", "user=", "INFO", "WARN", "ERROR", "request", "completed",
+    "in", "ms", "from"};
+  static const int levels[] = {20, 24};
+  int nwords = sizeof(words) / sizeof(words[0]);
+  unsigned char* text = malloc(BENCH_TEXT);
+  struct membuf m = {.data = 0, .len = 0, .cap = 0, .pos = 0};
+  Options opt = {.maxbits = 0};
+  EncoderStats stats;
+  BitWriter bw;
+  Encoder enc;
+  size_t n = 0, len;
+  int i, j;
+  char name[64], line[256];
+
+  //lines of common words and random numbers, so the table keeps growing.
+  //Each line is built on its own, and the last one cut to fit in text.
+  while(n < BENCH_TEXT){
+    len = sprintf(line, "%u.%u.%u.%u ", randomNumber() % 256,
+                  randomNumber() % 256, randomNumber() % 256,
+                  randomNumber() % 256);
+    for(i = randomNumber() % 8 + 2; i > 0; i--){
+      //earlier words are more common
+      j = randomNumber() % nwords + 1;
+      len += snprintf(line + len, sizeof(line) - len, "%s ",
+                      words[randomNumber() % j]);
+    }
+    len += snprintf(line + len, sizeof(line) - len, "%u\n",
+                    randomNumber() % 100000);
+    if(len > BENCH_TEXT - n) len = BENCH_TEXT - n;
+    memcpy(text + n, line, len);
+    n += len;
+  }
+
+  for(i = 0; i < (int)(sizeof(levels) / sizeof(levels[0])); i++){
+    m.len = 0;
+    opt.maxbits = levels[i];
+    bw = bitWriterCreate(memSink, &m);
+    enc = encoderCreate(&opt, bw);
+    countersStart(c);
+    encoderWrite(enc, text, BENCH_TEXT);
+    encoderFinish(enc);
+    countersStop(c);
+    encoderStats(enc, &stats);
+    sprintf(name, "encode byte -m %d (%.0f%% hot)", levels[i],
+            stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0);
+    report(name, c, BENCH_TEXT);
+    encoderDestroy(enc);
+    bitWriterDestroy(bw);
+  }
+
+  free(text);
+  free(m.data);
+}
+
+// -----------------------------------------------------------------------------
+// int main
+// -----------------------------------------------------------------------------
+// Description:
+//   runs all the microbenchmarks, or those named on the command line
+//   (insert, lookup, prune, bits and encode)
+// Parameters:
+//   int argc - number of command line arguments
+//   char* argv[] - array of strings representing command line arguments
+// Return values:
+//   0 - indicates successful completion of the program
+
+int main(int argc, char* argv[]){
+  static const struct{
+    const char* name;
+    void (*run)(struct counters*);
+  } benches[] = {{"insert", benchInsert}, {"lookup", benchLookup},
+                 {"prune", benchPrune}, {"bits", benchBits},
+                 {"encode", benchEncode}};
+  struct counters c;
+  int i, j, run;
+
+  countersOpen(&c);
+  if(c.fd[0] < 0){
+    printf("(hardware counters are not available, only times are shown)\n");
+  }
+  printf("%-28s %10s %10s %10s %10s %10s\n", "per operation", "ns", "cycles",
+         "instrs", "cache-miss", "branch-mis");
+
+  for(i = 0; i < (int)(sizeof(benches) / sizeof(benches[0])); i++){
+    run = argc == 1;
+    for(j = 1; j < argc; j++){
+      if(!strcmp(argv[j], benches[i].name)) run = 1;
+    }
+    if(run) benches[i].run(&c);
+  }
+
+  for(i = 0; i < NUM_COUNTERS; i++){
+    if(c.fd[i] >= 0) close(c.fd[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+/*
+probes.h
+contains the static tracepoints (USDT probes) of the lzw provider, for
+bpftrace, perf and other tracers
+
+The probes are built when <sys/sdt.h> is available (the Makefile then defines
+HAVE_SDT). Each one is a single nop instruction until a tracer attaches to it,
+so they are left in production builds. Without HAVE_SDT they compile to
+nothing. Every probe has a semaphore, which tracers raise while they are
+attached, so work done only for a probe's arguments (like timing a prune)
+can be skipped with PROBE_ENABLED when nobody is listening.
+
+  prune_start(elts, window, time)     HashArrayPrune is called on a table
+                                      with elts entries
+  prune_done(before, after, ns)       it is done, leaving after of the before
+                                      entries, in ns nanoseconds
+  table_full(size)                    the last free entry of a table is used
+  nbits(nbits, elts)                  the encoder widens its codes to nbits
+  decode_nbits(nbits)                 the decoder widens its codes to nbits
+  escape(kar)                         the encoder sends an escape code
+  flush(bytes, total)                 a BitWriter hands bytes to its sink,
+                                      total before them
+*/
+
+#ifdef HAVE_SDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#include <time.h>
+
+#define PROBE1(name, a) DTRACE_PROBE1(lzw, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(lzw, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(lzw, name, a, b, c)
+#define PROBE_ENABLED(name) __builtin_expect(lzw_##name##_semaphore != 0, 0)
+
+//the semaphores, defined in globals.c
+extern unsigned short lzw_prune_start_semaphore, lzw_prune_done_semaphore,
+                      lzw_table_full_semaphore, lzw_nbits_semaphore,
+                      lzw_decode_nbits_semaphore, lzw_escape_semaphore,
+                      lzw_flush_semaphore;
+
+// -----------------------------------------------------------------------------
+// int64_t probeNow
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the current time of a monotonic clock in nanoseconds, for the
+//   durations given to probes
+// Return value:
+//   the time, or 0 if probes are not built
+
+static inline int64_t probeNow(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#else
+
+//the arguments are still used, so variables kept only for probes don't warn
+#define PROBE1(name, a) ((void)(a))
+#define PROBE2(name, a, b) ((void)(a), (void)(b))
+#define PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#define PROBE_ENABLED(name) 0
+#define probeNow() ((int64_t)0)
+
+#endif
@@ -0,0 +1,509 @@
+/*
+server.c
+contains implementation code for lzwd, the compression server
+*/
+
+#define _GNU_SOURCE
+#include "globals.h"
+#include "bitio.h"
+#include "encode.h"
+#include "decode.h"
+#include "budget.h"
+#include "server.h"
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define SERVER_BUFSIZE (1 << 16)   //bytes read from a client at a time
+#define REQUEST_MAXLEN (256)       //longest request line accepted
+#define SERVER_TIMEOUT (30)        //seconds a client may leave a send or
+                                   //receive waiting before it is dropped
+#define SERVER_MEMORY ((uint64_t)1 << 30) //table memory per worker when
+                                          //--max-memory isn't given
+
+// -----------------------------------------------------------------------------
+// struct pending
+// -----------------------------------------------------------------------------
+// Description:
+//   an accepted connection waiting for a worker
+// Fields:
+//   int fd - the connection
+//   double accepted - when it was accepted, in milliseconds
+
+struct pending{
+  int fd;
+  double accepted;
+};
+
+// -----------------------------------------------------------------------------
+// struct server
+// -----------------------------------------------------------------------------
+// Description:
+//   the state shared by the accepting thread and the workers
+// Fields:
+//   struct pending* queue - a ring of accepted connections
+//   int size - the capacity of queue
+//   int head - the index of the oldest connection in queue
+//   int count - the number of connections in queue
+//   uint64_t maxmemory - the table memory each worker may use
+//   pthread_mutex_t lock - protects the queue
+//   pthread_cond_t nonempty - signalled when a connection is queued
+//   pthread_cond_t nonfull - signalled when a connection is taken
+
+struct server{
+  struct pending* queue;
+  int size;
+  int head;
+  int count;
+  uint64_t maxmemory;
+  pthread_mutex_t lock;
+  pthread_cond_t nonempty;
+  pthread_cond_t nonfull;
+};
+
+// -----------------------------------------------------------------------------
+// struct worker
+// -----------------------------------------------------------------------------
+// Description:
+//   a worker thread, with everything it keeps between requests
+// Fields:
+//   int id - the worker's number, used in the statistics
+//   struct server* srv - the server the worker takes connections from
+//   int fd - the connection being served
+//   int failed - 1 if the connection broke during the current request
+//   Encoder enc, Decoder dec - created by the first request that needs them,
+//                              and reset for each later one with the same
+//                              maxbits
+//   int encbits, decbits - the maxbits of enc and dec
+//   uint64_t encbytes, decbytes - the table memory enc and dec may use
+//   BitReader in - reads the request data from fd
+//   BitWriter out - writes the response to fd
+//   unsigned char buf[] - the buffer for data to compress
+
+struct worker{
+  int id;
+  struct server* srv;
+  int fd;
+  int failed;
+  Encoder enc;
+  Decoder dec;
+  int encbits;
+  int decbits;
+  uint64_t encbytes;
+  uint64_t decbytes;
+  BitReader in;
+  BitWriter out;
+  unsigned char buf[SERVER_BUFSIZE];
+};
+
+// -----------------------------------------------------------------------------
+// double milliseconds
+// -----------------------------------------------------------------------------
+// Description:
+//   returns the time on a monotonic clock in milliseconds
+
+static double milliseconds(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// -----------------------------------------------------------------------------
+// size_t socketSink, socketSource
+// -----------------------------------------------------------------------------
+// Description:
+//   a ByteSink and a ByteSource for a worker's connection, ctx is the struct
+//   worker*. When the client goes away the worker is marked as failed: the
+//   sink then throws the bytes away, since a short write would end the whole
+//   process, and the source reports the end of the input.
+
+static size_t socketSink(void* ctx, const unsigned char* buf, size_t n){
+  struct worker* w = ctx;
+  size_t done = 0;
+  ssize_t sent;
+
+  while(done < n && !w->failed){
+    sent = send(w->fd, buf + done, n - done, MSG_NOSIGNAL);
+    if(sent > 0){
+      done += sent;
+    }
+    else if(errno != EINTR){
+      w->failed = 1;
+    }
+  }
+
+  return n;
+}
+
+static size_t socketSource(void* ctx, unsigned char* buf, size_t n){
+  struct worker* w = ctx;
+  ssize_t got;
+
+  if(w->failed) return 0;
+
+  do{
+    got = recv(w->fd, buf, n, 0);
+  } while(got < 0 && errno == EINTR);
+
+  if(got < 0){
+    w->failed = 1;
+    return 0;
+  }
+
+  return got;
+}
+
+// -----------------------------------------------------------------------------
+// int readRequest
+// -----------------------------------------------------------------------------
+// Description:
+//   reads a request line from a connection and parses it. The line is read a
+//   byte at a time, so none of the data after it is consumed.
+// Parameters:
+//   int fd - the connection
+//   Options* req - set to the encoding parameters of a compress request
+// Return value:
+//   'C' or 'D' for a valid request, -1 if the client sent no complete line
+//   within SERVER_TIMEOUT, 0 otherwise
+
+static int readRequest(int fd, Options* req){
+  char line[REQUEST_MAXLEN + 1];
+  char *tok, *save, *end;
+  long long j;
+  int len = 0, op;
+  ssize_t got;
+
+  for(;;){
+    got = recv(fd, line + len, 1, 0);
+    if(got < 0 && errno == EINTR) continue;
+    if(got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return -1;
+    if(got <= 0 || len == REQUEST_MAXLEN) return 0;
+    if(line[len] == '\n') break;
+    len++;
+  }
+  line[len] = '\0';
+
+  if((tok = strtok_r(line, " \t\r", &save)) == 0 || tok[1] != '\0'){
+    return 0;
+  }
+  op = tok[0];
+  if(op != 'C' && op != 'D') return 0;
+
+  req->maxbits = DEFAULT_MAXBITS;
+  req->prune = 0;
+  req->escape = 0;
+
+  while((tok = strtok_r(0, " \t\r", &save)) != 0){
+    if(op != 'C') return 0;
+
+    if(!strcmp(tok, "-e")){
+      req->escape = 1;
+      continue;
+    }
+    if((strcmp(tok, "-m") && strcmp(tok, "-p"))
+       || (end = strtok_r(0, " \t\r", &save)) == 0){
+      return 0;
+    }
+
+    j = strtoll(end, &end, 10);
+    if(*end != '\0') return 0;
+    if(tok[1] == 'm'){
+      if(j < MIN_MAXBITS || j > MAX_MAXBITS) return 0;
+      req->maxbits = (int)j;
+    }
+    else{
+      if(j <= 0 || j >= ((int64_t)1 << BITS_TO_SEND_WINDOW_EXT)) return 0;
+      req->prune = (int64_t)j;
+    }
+  }
+
+  return op;
+}
+
+// -----------------------------------------------------------------------------
+// int compressRequest, decompressRequest
+// -----------------------------------------------------------------------------
+// Description:
+//   serve a request whose request line has been read, printing its statistics
+// Parameters:
+//   struct worker* w - the worker serving the request
+//   Options* req - the parameters from the request line
+//   double queued - how long the connection waited for a worker, in ms
+//   double start - when the worker took the connection, in ms
+// Return value:
+//   0 if the request succeeded, -1 if it failed
+
+static int compressRequest(struct worker* w, Options* req, double queued,
+                           double start){
+  uint64_t need = memoryFootprint(req);
+  EncoderStats stats;
+  size_t n;
+
+  if(need > w->srv->maxmemory){
+    fprintf(stderr, "lzwd: worker %d: refused compress -m %d, needs more than "
+            "%" PRIu64 " bytes\n", w->id, req->maxbits, w->srv->maxmemory);
+    return -1;
+  }
+
+  //the kept decoder counts against the same share, so free it if both
+  //tables don't fit
+  if(w->dec && need + w->decbytes > w->srv->maxmemory){
+    decoderDestroy(w->dec);
+    w->dec = 0;
+    w->decbytes = 0;
+  }
+
+  //a table of another size is freed before the new one is allocated, and
+  //running out of memory only fails this request
+  if(w->enc && w->encbits != req->maxbits){
+    encoderDestroy(w->enc);
+    w->enc = 0;
+    w->encbytes = 0;
+  }
+  if(w->enc){
+    encoderReset(w->enc, req);
+  }
+  else if((w->enc = encoderTryCreate(req, w->out)) == 0){
+    fprintf(stderr, "lzwd: worker %d: compress -m %d failed, could not "
+            "allocate its string table\n", w->id, req->maxbits);
+    return -1;
+  }
+  w->encbits = req->maxbits;
+  w->encbytes = need;
+
+  while(!w->failed && (n = socketSource(w, w->buf, SERVER_BUFSIZE)) > 0){
+    encoderWrite(w->enc, w->buf, n);
+  }
+  encoderFinish(w->enc);
+  if(w->failed) return -1;
+
+  encoderStats(w->enc, &stats);
+  flockfile(stderr);
+  fprintf(stderr, "lzwd: worker %d: compress -m %d -p %" PRId64 "%s, queued "
+          "%.1f ms, served %.1f ms: ", w->id, req->maxbits, req->prune,
+          req->escape ? " -e" : "", queued, milliseconds() - start);
+  printEncoderStats(stderr, &stats);
+  funlockfile(stderr);
+
+  return 0;
+}
+
+static int decompressRequest(struct worker* w, double queued, double start){
+  Options streamopt = {.maxbits = 0};
+  uint64_t written = bytesWritten(w->out);
+  uint64_t produced, position, need;
+  int status;
+
+  if(decoderReadHeader(w->in, &streamopt) != 0){
+    fprintf(stderr, "lzwd: worker %d: decompress failed, bad header\n", w->id);
+    return -1;
+  }
+  need = memoryFootprint(&streamopt);
+  if(need > w->srv->maxmemory){
+    fprintf(stderr, "lzwd: worker %d: refused decompress -m %d, needs more "
+            "than %" PRIu64 " bytes\n", w->id, streamopt.maxbits,
+            w->srv->maxmemory);
+    return -1;
+  }
+
+  //likewise for the kept encoder
+  if(w->enc && need + w->encbytes > w->srv->maxmemory){
+    encoderDestroy(w->enc);
+    w->enc = 0;
+    w->encbytes = 0;
+  }
+
+  if(w->dec && w->decbits != streamopt.maxbits){
+    decoderDestroy(w->dec);
+    w->dec = 0;
+    w->decbytes = 0;
+  }
+  if(w->dec){
+    decoderReset(w->dec, &streamopt);
+  }
+  else if((w->dec = decoderTryCreate(&streamopt, w->in, w->out)) == 0){
+    fprintf(stderr, "lzwd: worker %d: decompress -m %d failed, could not "
+            "allocate its string table\n", w->id, streamopt.maxbits);
+    return -1;
+  }
+  w->decbits = streamopt.maxbits;
+  w->decbytes = need;
+
+  //pass on everything decoded so far at every sync point
+  while((status = decoderRun(w->dec)) == DECODE_SYNC){
+    sendRemainingBits(w->out);
+  }
+  sendRemainingBits(w->out);
+
+  decoderProgress(w->dec, &produced, &position);
+  if(status == DECODE_CORRUPT || w->failed){
+    fprintf(stderr, "lzwd: worker %d: decompress failed at byte %" PRIu64
+            " of input, after %" PRIu64 " bytes of output\n", w->id,
+            position / CHAR_BIT, produced);
+    return -1;
+  }
+
+  fprintf(stderr, "lzwd: worker %d: decompress, queued %.1f ms, served %.1f "
+          "ms: %" PRIu64 " bytes in, %" PRIu64 " bytes out\n", w->id, queued,
+          milliseconds() - start, bitsRead(w->in) / CHAR_BIT,
+          bytesWritten(w->out) - written);
+
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// void* workerThread
+// -----------------------------------------------------------------------------
+// Description:
+//   the main loop of a worker: takes connections from the queue and serves
+//   them one at a time
+// Parameters:
+//   void* arg - the struct worker*
+
+static void* workerThread(void* arg){
+  struct worker* w = arg;
+  struct server* srv = w->srv;
+  struct linger reset = {.l_onoff = 1, .l_linger = 0};
+  struct timeval timeout = {.tv_sec = SERVER_TIMEOUT, .tv_usec = 0};
+  struct pending p;
+  Options req;
+  double start;
+  int status, op;
+
+  for(;;){
+    pthread_mutex_lock(&srv->lock);
+    while(srv->count == 0){
+      pthread_cond_wait(&srv->nonempty, &srv->lock);
+    }
+    p = srv->queue[srv->head];
+    srv->head = (srv->head + 1) % srv->size;
+    srv->count--;
+    pthread_cond_signal(&srv->nonfull);
+    pthread_mutex_unlock(&srv->lock);
+
+    start = milliseconds();
+    w->fd = p.fd;
+    w->failed = 0;
+
+    //a client that stops sending or reading must not hold the worker
+    setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(w->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    bitReaderReset(w->in);
+    bitWriterReset(w->out);
+
+    op = readRequest(w->fd, &req);
+    if(op == -1){
+      fprintf(stderr, "lzwd: worker %d: timed out waiting for the request "
+              "line\n", w->id);
+      status = -1;
+    }
+    else if(op == 0){
+      fprintf(stderr, "lzwd: worker %d: bad request line\n", w->id);
+      status = -1;
+    }
+    else if(op == 'C'){
+      status = compressRequest(w, &req, start - p.accepted, start);
+    }
+    else{
+      status = decompressRequest(w, start - p.accepted, start);
+    }
+
+    //reset the connection on failure, so the client can tell
+    if(status != 0){
+      setsockopt(w->fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    }
+    close(w->fd);
+  }
+
+  return 0;
+}
+
+void serve(Options* opt){
+  struct server srv;
+  struct worker* workers;
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  struct stat st;
+  pthread_t thread;
+  int listener, fd, i;
+
+  if(strlen(opt->socket) >= sizeof(addr.sun_path)){
+    fprintf(stderr, "Error: socket path %s is too long.\n", opt->socket);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, opt->socket);
+
+  //replace a socket left behind by an earlier server, but nothing else
+  if(stat(opt->socket, &st) == 0 && S_ISSOCK(st.st_mode)){
+    unlink(opt->socket);
+  }
+
+  if((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+     || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0
+     || listen(listener, opt->queue) != 0){
+    fprintf(stderr, "Error: could not listen on %s: %s.\n", opt->socket,
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  //a client going away must not end the server
+  signal(SIGPIPE, SIG_IGN);
+
+  srv.size = opt->queue;
+  srv.queue = malloc(srv.size * sizeof(*srv.queue));
+  srv.head = 0;
+  srv.count = 0;
+  srv.maxmemory = opt->maxmemory ? opt->maxmemory / opt->threads
+                                  : SERVER_MEMORY;
+  pthread_mutex_init(&srv.lock, 0);
+  pthread_cond_init(&srv.nonempty, 0);
+  pthread_cond_init(&srv.nonfull, 0);
+
+  workers = malloc(opt->threads * sizeof(*workers));
+  for(i = 0; i < opt->threads; i++){
+    workers[i].id = i;
+    workers[i].srv = &srv;
+    workers[i].enc = 0;
+    workers[i].dec = 0;
+    workers[i].encbytes = 0;
+    workers[i].decbytes = 0;
+    workers[i].in = bitReaderCreate(socketSource, &workers[i]);
+    workers[i].out = bitWriterCreate(socketSink, &workers[i]);
+    if(pthread_create(&thread, 0, workerThread, &workers[i]) != 0){
+      fprintf(stderr, "Error: could not start worker threads.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  fprintf(stderr, "lzwd: listening on %s with %d workers\n", opt->socket,
+          opt->threads);
+
+  for(;;){
+    //wait for room in the queue before accepting, so that a busy server
+    //leaves new clients waiting in the listen backlog
+    pthread_mutex_lock(&srv.lock);
+    while(srv.count == srv.size){
+      pthread_cond_wait(&srv.nonfull, &srv.lock);
+    }
+    pthread_mutex_unlock(&srv.lock);
+
+    if((fd = accept(listener, 0, 0)) < 0){
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      fprintf(stderr, "Error: could not accept connections: %s.\n",
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&srv.lock);
+    srv.queue[(srv.head + srv.count) % srv.size].fd = fd;
+    srv.queue[(srv.head + srv.count) % srv.size].accepted = milliseconds();
+    srv.count++;
+    pthread_cond_signal(&srv.nonempty);
+    pthread_mutex_unlock(&srv.lock);
+  }
+}
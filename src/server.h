@@ -0,0 +1,38 @@
+/*
+server.h
+contains declarations for lzwd, a server which compresses and decompresses
+streams for clients connecting to a Unix domain socket
+
+Each connection carries one request. The client sends a request line, then
+the data, then shuts down its side of the connection for writing. The server
+streams back the result and closes the connection. The request line is
+
+  C [-m MAXBITS] [-p WINDOW] [-e]    to compress
+  D                                  to decompress
+
+If the request fails the connection is reset instead of closed normally, so
+clients see an error rather than a short response. A client that leaves
+the server waiting to send or receive for more than 30 seconds is dropped
+the same way.
+*/
+
+// -----------------------------------------------------------------------------
+// void serve
+// -----------------------------------------------------------------------------
+// Description:
+//   listens on a Unix domain socket and serves requests until the process is
+//   killed. A fixed pool of worker threads handles the requests, each keeping
+//   its string tables and buffers from one request to the next. At most
+//   opt->queue accepted connections wait for a worker; beyond that the server
+//   stops accepting, and further clients wait in the listen backlog.
+//   A line of statistics is printed to stderr for each request.
+// Parameters:
+//   Options* opt - a pointer to an options struct giving the socket path, the
+//                  number of threads, the queue length, and the maxmemory
+//                  budget, which is shared equally between the workers.
+//                  Without a budget each worker gets 1GB. A worker's
+//                  encoder and decoder tables together stay within its
+//                  share, and a table that can't be allocated only fails
+//                  its request.
+
+void serve(Options* opt);
@@ -0,0 +1,358 @@
+/*
+verify.c
+contains implementation code for checking a compressed stream while it is
+being written, by decoding it on a second thread and comparing the result
+with the input
+*/
+
+#define _GNU_SOURCE
+#include "globals.h"
+#include "bitio.h"
+#include "decode.h"
+#include "verify.h"
+#include <pthread.h>
+
+//input kept waiting for comparison before verifierInput waits
+#define VERIFY_MAX_RETAINED ((size_t)64 << 20)
+
+// -----------------------------------------------------------------------------
+// struct chunk
+// -----------------------------------------------------------------------------
+// Description:
+//   a buffer in one of the verifier's queues
+// Fields:
+//   struct chunk* next - the next chunk in the queue
+//   size_t len - the number of bytes in data
+//   unsigned char data[] - the bytes
+
+struct chunk{
+  struct chunk* next;
+  size_t len;
+  unsigned char data[];
+};
+
+// -----------------------------------------------------------------------------
+// struct queue
+// -----------------------------------------------------------------------------
+// Fields:
+//   struct chunk *head, *tail - the first and last chunks
+//   size_t pos - the number of bytes of head already used
+//   size_t bytes - the number of unused bytes in the queue
+
+struct queue{
+  struct chunk* head;
+  struct chunk* tail;
+  size_t pos;
+  size_t bytes;
+};
+
+// -----------------------------------------------------------------------------
+// struct verifier
+// -----------------------------------------------------------------------------
+// Fields:
+//   FILE* out - the file the compressed stream is written to
+//   struct queue input - input not yet compared
+//   struct queue compressed - compressed bytes not yet decoded
+//   int closed - 1 once the compressed stream has ended
+//   int starved - 1 while the decoding thread waits for compressed bytes
+//   uint64_t offset - the number of bytes compared so far
+//   int failed - 1 once the decoding thread has found a difference
+//   uint64_t failedat - the offset of the first byte that differs
+//   pthread_mutex_t lock - protects everything above
+//   pthread_cond_t changed - signalled whenever a queue changes
+//   pthread_t thread - the decoding thread
+
+struct verifier{
+  FILE* out;
+  struct queue input;
+  struct queue compressed;
+  int closed;
+  int starved;
+  uint64_t offset;
+  int failed;
+  uint64_t failedat;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pthread_t thread;
+};
+
+// -----------------------------------------------------------------------------
+// void queuePush
+// -----------------------------------------------------------------------------
+// Description:
+//   adds a copy of some bytes to the end of a queue, with the lock held
+// Parameters:
+//   struct queue* q - the queue to add to
+//   const unsigned char* buf - the bytes to add
+//   size_t n - the number of bytes in buf
+
+static void queuePush(struct queue* q, const unsigned char* buf, size_t n){
+  struct chunk* c = malloc(sizeof(*c) + n);
+
+  c->next = 0;
+  c->len = n;
+  memcpy(c->data, buf, n);
+
+  if(q->tail) q->tail->next = c;
+  else q->head = c;
+  q->tail = c;
+  q->bytes += n;
+}
+
+// -----------------------------------------------------------------------------
+// size_t queuePop
+// -----------------------------------------------------------------------------
+// Description:
+//   takes bytes from the front of a queue, with the lock held
+// Parameters:
+//   struct queue* q - the queue to take from
+//   unsigned char* buf - where the bytes are copied, or a null pointer to
+//                        just return a pointer to them through *from
+//   const unsigned char** from - set to the bytes if buf is null
+//   size_t n - the maximum number of bytes to take
+// Return value:
+//   the number of bytes taken, at most the rest of the first chunk
+
+static size_t queuePop(struct queue* q, unsigned char* buf,
+                       const unsigned char** from, size_t n){
+  struct chunk* c = q->head;
+
+  if(c == 0) return 0;
+  if(n > c->len - q->pos) n = c->len - q->pos;
+
+  if(buf) memcpy(buf, c->data + q->pos, n);
+  else *from = c->data + q->pos;
+
+  q->pos += n;
+  q->bytes -= n;
+  if(q->pos == c->len && buf){
+    q->head = c->next;
+    if(q->head == 0) q->tail = 0;
+    q->pos = 0;
+    free(c);
+  }
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void queueDrop
+// -----------------------------------------------------------------------------
+// Description:
+//   frees the first chunk of a queue if it has been used up, with the lock held
+// Parameters:
+//   struct queue* q - the queue
+
+static void queueDrop(struct queue* q){
+  struct chunk* c = q->head;
+
+  if(c && q->pos == c->len){
+    q->head = c->next;
+    if(q->head == 0) q->tail = 0;
+    q->pos = 0;
+    free(c);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// void mismatch
+// -----------------------------------------------------------------------------
+// Description:
+//   records a verification failure on the decoding thread, with the lock
+//   held, and wakes the encoding thread to report it. Only the first
+//   failure is kept.
+// Parameters:
+//   Verifier v - the verifier
+//   uint64_t offset - the offset of the first byte that doesn't match
+
+static void mismatch(Verifier v, uint64_t offset){
+  if(!v->failed){
+    v->failed = 1;
+    v->failedat = offset;
+  }
+  pthread_cond_broadcast(&v->changed);
+}
+
+// -----------------------------------------------------------------------------
+// void exitMismatch
+// -----------------------------------------------------------------------------
+// Description:
+//   reports a verification failure and exits the program, on the encoding
+//   thread once the decoding thread has finished
+// Parameters:
+//   uint64_t offset - the offset of the first byte that doesn't match
+
+static void exitMismatch(uint64_t offset){
+  fprintf(stderr, "Error: verification failed, decoded output differs from "
+          "the input at byte %" PRIu64 ".\n", offset);
+  exit(EXIT_FAILURE);
+}
+
+// -----------------------------------------------------------------------------
+// void reportMismatch
+// -----------------------------------------------------------------------------
+// Description:
+//   called on the encoding thread, with the lock held, once a failure has
+//   been recorded. Waits for the decoding thread to finish before exiting,
+//   so the exit can't cut into a write.
+// Parameters:
+//   Verifier v - the verifier
+
+static void reportMismatch(Verifier v){
+  uint64_t offset = v->failedat;
+
+  pthread_mutex_unlock(&v->lock);
+  pthread_join(v->thread, 0);
+  exitMismatch(offset);
+}
+
+// -----------------------------------------------------------------------------
+// size_t compressedSource
+// -----------------------------------------------------------------------------
+// Description:
+//   the decoding thread's ByteSource, ctx is the Verifier. Waits for the
+//   encoder to write compressed bytes, and ends the stream after a failure.
+
+static size_t compressedSource(void* ctx, unsigned char* buf, size_t n){
+  Verifier v = ctx;
+
+  pthread_mutex_lock(&v->lock);
+  while(v->compressed.bytes == 0 && !v->closed && !v->failed){
+    v->starved = 1;
+    pthread_cond_broadcast(&v->changed);
+    pthread_cond_wait(&v->changed, &v->lock);
+  }
+  v->starved = 0;
+  n = v->failed ? 0 : queuePop(&v->compressed, buf, 0, n);
+  pthread_mutex_unlock(&v->lock);
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// size_t compareSink
+// -----------------------------------------------------------------------------
+// Description:
+//   the decoding thread's ByteSink, ctx is the Verifier. Compares the decoded
+//   bytes with the input, and frees the input once it has been compared.
+//   After a failure the rest of the decoded bytes are ignored.
+
+static size_t compareSink(void* ctx, const unsigned char* buf, size_t n){
+  Verifier v = ctx;
+  const unsigned char* from;
+  size_t done = 0, len, i;
+
+  pthread_mutex_lock(&v->lock);
+  while(done < n && !v->failed){
+    //the input was queued before it was encoded, so it is already there
+    if((len = queuePop(&v->input, 0, &from, n - done)) == 0){
+      mismatch(v, v->offset);
+      break;
+    }
+    if(memcmp(from, buf + done, len)){
+      for(i = 0; from[i] == buf[done + i]; i++);
+      mismatch(v, v->offset + i);
+      break;
+    }
+    queueDrop(&v->input);
+    v->offset += len;
+    done += len;
+  }
+  pthread_cond_broadcast(&v->changed);
+  pthread_mutex_unlock(&v->lock);
+
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+// void* verifyThread
+// -----------------------------------------------------------------------------
+// Description:
+//   the decoding thread, decodes the compressed stream into compareSink
+// Parameters:
+//   void* arg - the Verifier
+// Return value:
+//   always a null pointer
+
+static void* verifyThread(void* arg){
+  Verifier v = arg;
+  BitReader in = bitReaderCreate(compressedSource, v);
+  BitWriter out = bitWriterCreate(compareSink, v);
+  Options streamopt = {.maxbits = 0};
+  Decoder dec;
+  int status;
+
+  if(decoderReadHeader(in, &streamopt) != 0){
+    pthread_mutex_lock(&v->lock);
+    mismatch(v, 0);
+    pthread_mutex_unlock(&v->lock);
+  }
+  else{
+    dec = decoderCreate(&streamopt, in, out);
+    while((status = decoderRun(dec)) == DECODE_SYNC);
+    sendRemainingBits(out);
+
+    //the decoded stream must not be shorter than the input either
+    pthread_mutex_lock(&v->lock);
+    if(status == DECODE_CORRUPT || v->input.bytes != 0){
+      mismatch(v, v->offset);
+    }
+    pthread_mutex_unlock(&v->lock);
+    decoderDestroy(dec);
+  }
+
+  bitWriterDestroy(out);
+  bitReaderDestroy(in);
+
+  return 0;
+}
+
+Verifier verifierCreate(FILE* out){
+  Verifier v = calloc(1, sizeof(*v));
+
+  v->out = out;
+  pthread_mutex_init(&v->lock, 0);
+  pthread_cond_init(&v->changed, 0);
+  pthread_create(&v->thread, 0, verifyThread, v);
+
+  return v;
+}
+
+void verifierInput(Verifier v, const unsigned char* buf, size_t n){
+  pthread_mutex_lock(&v->lock);
+  while(v->input.bytes > VERIFY_MAX_RETAINED && !v->failed
+        && !(v->starved && v->compressed.bytes == 0)){
+    pthread_cond_wait(&v->changed, &v->lock);
+  }
+  if(v->failed) reportMismatch(v);
+  queuePush(&v->input, buf, n);
+  pthread_mutex_unlock(&v->lock);
+}
+
+size_t verifierSink(void* ctx, const unsigned char* buf, size_t n){
+  Verifier v = ctx;
+
+  n = fwrite(buf, 1, n, v->out);
+
+  pthread_mutex_lock(&v->lock);
+  if(v->failed) reportMismatch(v);
+  queuePush(&v->compressed, buf, n);
+  pthread_cond_broadcast(&v->changed);
+  pthread_mutex_unlock(&v->lock);
+
+  return n;
+}
+
+void verifierFinish(Verifier v){
+  pthread_mutex_lock(&v->lock);
+  v->closed = 1;
+  pthread_cond_broadcast(&v->changed);
+  pthread_mutex_unlock(&v->lock);
+
+  pthread_join(v->thread, 0);
+  if(v->failed) exitMismatch(v->failedat);
+
+  pthread_mutex_destroy(&v->lock);
+  pthread_cond_destroy(&v->changed);
+  free(v);
+}
@@ -0,0 +1,60 @@
+/*
+verify.h
+contains declarations for checking a compressed stream while it is being
+written, by decoding it on a second thread and comparing the result with the
+input
+*/
+
+typedef struct verifier *Verifier;
+
+// -----------------------------------------------------------------------------
+// Verifier verifierCreate
+// -----------------------------------------------------------------------------
+// Description:
+//   creates a verifier and starts its decoding thread
+// Parameters:
+//   FILE* out - the file the compressed stream is written to
+// Return value:
+//   a new Verifier
+
+Verifier verifierCreate(FILE* out);
+
+// -----------------------------------------------------------------------------
+// void verifierInput
+// -----------------------------------------------------------------------------
+// Description:
+//   keeps a copy of input bytes until the decoded stream has been compared
+//   with them. Must be called before the bytes are passed to the encoder.
+//   Waits while too much input is waiting to be compared, unless the
+//   decoding thread has run out of compressed bytes.
+// Parameters:
+//   Verifier v - the Verifier to give the input to
+//   const unsigned char* buf - the input bytes
+//   size_t n - the number of bytes in buf
+
+void verifierInput(Verifier v, const unsigned char* buf, size_t n);
+
+// -----------------------------------------------------------------------------
+// size_t verifierSink
+// -----------------------------------------------------------------------------
+// Description:
+//   a ByteSink for the encoder's BitWriter, ctx is the Verifier. The bytes are
+//   written to the verifier's output file and queued for the decoding thread.
+
+size_t verifierSink(void* ctx, const unsigned char* buf, size_t n);
+
+// -----------------------------------------------------------------------------
+// void verifierFinish
+// -----------------------------------------------------------------------------
+// Description:
+//   marks the end of the compressed stream, waits for the decoding thread to
+//   compare the rest of it and frees the Verifier.
+//   If the decoded stream differs from the input at any point, the decoding
+//   thread records the offset and stops. The encoding thread then reports it
+//   on stderr and exits the program, at its next call to verifierInput or
+//   verifierSink or here, so this only returns if the whole stream was
+//   verified.
+// Parameters:
+//   Verifier v - the Verifier to finish
+
+void verifierFinish(Verifier v);